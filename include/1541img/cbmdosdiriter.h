@@ -0,0 +1,82 @@
+#ifndef I1541_CBMDOSDIRITER_H
+#define I1541_CBMDOSDIRITER_H
+
+/** Declarations for iterating over a cbmdos directory on a raw image
+ * @file
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <1541img/decl.h>
+
+#include <1541img/cbmdosfile.h>
+#include <1541img/cbmdosfsoptions.h>
+
+/** An entry of a cbmdos directory.
+ * @struct CbmdosDirEntry cbmdosdiriter.h <1541img/cbmdosdiriter.h>
+ */
+C_CLASS_DECL(CbmdosDirEntry);
+
+struct CbmdosDirEntry
+{
+    char name[17];          /**< file name in PETSCII encoding, without
+                                 the 0xa0 padding, 0-terminated */
+    uint8_t nameLength;     /**< length of the file name */
+    CbmdosFileType type;    /**< the file type, might be an invalid value
+                                 on a broken disk */
+    int locked;             /**< 1 if the file is locked, 0 otherwise */
+    int closed;             /**< 1 if the file is closed, 0 otherwise */
+    uint16_t blocks;        /**< number of blocks as shown in the
+                                 directory */
+    uint8_t track;          /**< track of the first block */
+    uint8_t sector;         /**< sector of the first block */
+    uint8_t sideTrack;      /**< track of the first side sector (REL) */
+    uint8_t sideSector;     /**< first side sector (REL) */
+    uint8_t recordLength;   /**< record length (REL) */
+};
+
+/** Iterator over the directory of a raw D64 image.
+ * This reads the directory directly from the bytes of a .d64 file, without
+ * creating a D64 or a CbmdosVfs and without allocating any memory, so it's
+ * well suited for scanning a lot of disk images. Declare it as a local
+ * variable and initialize it with CbmdosDirIter_init(). The image must stay
+ * valid while iterating.
+ * @class CbmdosDirIter cbmdosdiriter.h <1541img/cbmdosdiriter.h>
+ */
+C_CLASS_DECL(CbmdosDirIter);
+
+struct CbmdosDirIter
+{
+    const uint8_t *image;
+    uint32_t visited[42];
+    CbmdosFsFlags flags;
+    uint8_t tracks;
+    uint8_t track;
+    uint8_t sector;
+    uint8_t pos;
+};
+
+/** Initialize the iterator.
+ * @memberof CbmdosDirIter
+ * @param self the iterator
+ * @param image the raw contents of a .d64 file
+ * @param size the size of the image, must be the size of a valid .d64 file
+ * @param flags cbmdos filesystem flags, only CFF_ALLOWLONGDIR is used,
+ *     to follow directories leaving track 18
+ * @returns 0 on success, -1 on error (invalid size)
+ */
+DECLEXPORT int CbmdosDirIter_init(CbmdosDirIter *self,
+	const uint8_t *image, size_t size, CbmdosFsFlags flags);
+
+/** Get the next entry of the directory.
+ * Empty slots in the directory are skipped.
+ * @memberof CbmdosDirIter
+ * @param self the iterator
+ * @param entry the entry is written here
+ * @returns 1 if an entry was found, 0 at the end of the directory, -1 on
+ *     error (the directory chain is broken or contains a loop)
+ */
+DECLEXPORT int CbmdosDirIter_next(CbmdosDirIter *self, CbmdosDirEntry *entry);
+
+#endif
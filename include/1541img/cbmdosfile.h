@@ -113,6 +113,10 @@ DECLEXPORT void CbmdosFile_setName(
 DECLEXPORT void CbmdosFile_mapUpperGfxToLower(CbmdosFile *self);
 
 /** The read-only contents of the file
+ * If the file was read with readCbmdosVfsLazy() and its contents weren't
+ * accessed yet, this reads them from the disk image and stores them in the
+ * file, even though it's passed as const. Calling it for the same file from
+ * several threads at once must be synchronized.
  * @memberof CbmdosFile
  * @param self the cbmdos file
  * @returns a read-only pointer to the file contents
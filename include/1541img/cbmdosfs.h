@@ -18,7 +18,10 @@ typedef enum CbmdosFsStatus
     CFS_INVALIDBAM = 1 << 0,        /**< the BAM of the filesystem is invalid */
     CFS_DISKFULL = 1 << 1,          /**< the disk is full */
     CFS_DIRFULL = 1 << 2,           /**< no space left in directory */
-    CFS_BROKEN = 1 << 3             /**< filesystem is invalid */
+    CFS_BROKEN = 1 << 3,            /**< filesystem is invalid */
+    CFS_LAYOUTPENDING = 1 << 4      /**< changes weren't written to the disk
+                                         image yet (CFF_LAZYLAYOUT), call
+                                         CbmdosFs_flush() */
 } CbmdosFsStatus;
 
 /** Default options of a cbmdos filesystem.
@@ -27,6 +30,8 @@ typedef enum CbmdosFsStatus
  * * flags: **CFF_COMPATIBLE**
  * * dirInterleave: **3**
  * * fileInterleave: **10**
+ * * blockTime: **18000**
+ * * stepTime: **8000**
  * @relates CbmdosFsOptions
  */
 DECLDATA DECLEXPORT const CbmdosFsOptions CFO_DEFAULT;
@@ -55,10 +60,15 @@ DECLEXPORT CbmdosFs *CbmdosFs_create(CbmdosFsOptions options);
  * image, so after this call, the image will be owned by the CbmdosFs.
  * Therefore, you must not destroy the image yourself after constructing a
  * CbmdosFs from it.
+ *
+ * A CbmdosFs writes to its image on every change, so read-only images
+ * (see D64_readOnly()) are rejected. Open external buffers with
+ * D64_BM_COPYONWRITE instead, or just read the files with readCbmdosVfs().
  * @memberof CbmdosFs
- * @param d64 the disk image
+ * @param d64 the disk image, must not be read-only
  * @param options filesystem options, must be compatible with the image
- * @returns a CbmdosFs reflecting the disk image, or NULL on error
+ * @returns a CbmdosFs reflecting the disk image, or NULL on error (then the
+ *     image is still owned by the caller)
  */
 DECLEXPORT CbmdosFs *CbmdosFs_fromImage(D64 *d64, CbmdosFsOptions options);
 
@@ -71,6 +81,9 @@ DECLEXPORT CbmdosFs *CbmdosFs_fromImage(D64 *d64, CbmdosFsOptions options);
 DECLEXPORT CbmdosFs *CbmdosFs_fromVfs(CbmdosVfs *vfs, CbmdosFsOptions options);
 
 /** Status of the filesystem
+ * With CFF_LAZYLAYOUT, this is just CFS_LAYOUTPENDING as long as there are
+ * changes not written to the disk image, because whether they fit is only
+ * known after CbmdosFs_flush().
  * @memberof CbmdosFs
  * @param self the cbmdos filesystem
  * @returns the current status
@@ -92,6 +105,9 @@ DECLEXPORT const CbmdosVfs *CbmdosFs_rvfs(const CbmdosFs *self);
 DECLEXPORT CbmdosVfs *CbmdosFs_vfs(CbmdosFs *self);
 
 /** Gets the read-only disk image associated with this filesystem
+ * With CFF_LAZYLAYOUT, the image doesn't contain pending changes, which is
+ * indicated by CFS_LAYOUTPENDING in CbmdosFs_status(). Call CbmdosFs_flush()
+ * first.
  * @memberof CbmdosFs
  * @param self the cbmdos filesystem
  * @returns a read-only pointer to the D64 disk image
@@ -132,12 +148,43 @@ DECLEXPORT int CbmdosFs_optionsWillRewrite(
 	const CbmdosFs *self, CbmdosFsOptions options);
 
 /** Re-writes the filesystem to the disk image
+ * The disk image is cleared and reused. If the number of tracks changed,
+ * get it again with CbmdosFs_image() afterwards.
  * @memberof CbmdosFs
  * @param self the cbmdos filesystem
  * @returns 0 on success, -1 on error
  */
 DECLEXPORT int CbmdosFs_rewrite(CbmdosFs *self);
 
+/** Writes pending changes to the disk image
+ * This is only needed with CFF_LAZYLAYOUT, otherwise all changes are written
+ * immediately. If there are pending changes, the whole filesystem is written
+ * like with CbmdosFs_rewrite(). If the number of tracks changed, get the image
+ * again with CbmdosFs_image() afterwards.
+ * @memberof CbmdosFs
+ * @param self the cbmdos filesystem
+ * @returns 0 on success, -1 if not all files fit on the disk
+ */
+DECLEXPORT int CbmdosFs_flush(CbmdosFs *self);
+
+/** Defragment the filesystem on its disk image.
+ * All files are placed again with the given options, so every file gets a
+ * chain as contiguous as the allocation strategy allows, like on a freshly
+ * written disk. Directory order, REL side sectors and forced block counts
+ * are kept. The existing disk image is cleared and reused instead of
+ * creating a new one. If the options change the number of tracks, get the
+ * image again with CbmdosFs_image() afterwards.
+ * @memberof CbmdosFs
+ * @param self the cbmdos filesystem
+ * @param options the options for placing the files, these become the new
+ *     options of the filesystem
+ * @returns the number of file blocks (including REL side sectors) that
+ *     changed their position, or -1 on error (invalid options, read-only
+ *     image or not all files fit with the given options). On error, no
+ *     files are moved.
+ */
+DECLEXPORT int CbmdosFs_defragment(CbmdosFs *self, CbmdosFsOptions options);
+
 /** The number of free blocks in this filesystem.
  * This returns the number of free blocks as reported by cbmdos (optionally
  * with speeddos or dolphin dos for a 40track filesystem). Note that the option
@@ -35,6 +35,16 @@
  * strategy, because the head would have to seek from track 18 to track 1 in
  * the middle of loading.
  *
+ * CFF_TALLOC_LOADTIME modifies any track allocation strategy by ignoring the
+ * file interleave. Instead, the next block of a file is placed in the first
+ * free sector the drive reaches after handling the previous block, which
+ * takes the blockTime given in the options. This considers the different
+ * number of sectors per track in the speed zones, also when the file
+ * continues on another track, where moving the head takes the additional
+ * stepTime. Tracks are still filled completely before moving on to the next
+ * track. Use CbmdosLoadProfile from
+ * <1541img/cbmdosloadtime.h> to see the effect for a given loader.
+ *
  * If CFF_SIMPLEINTERLEAVE is set, interleave values are applied as one
  * would expect, by adding the interleave and taking the result modulo the
  * number of sectors.
@@ -42,6 +52,23 @@
  * Otherwise, interleave is applied in a more complicated way the original
  * CBM DOS uses: If applying the interleave wraps over sector 0, the result is
  * decremented by 1.
+ *
+ * If CFF_LAZYLAYOUT is set, changes to the virtual filesystem aren't written
+ * to the disk image immediately. Instead, the whole filesystem is written
+ * once by CbmdosFs_flush(), until then CbmdosFs_image() doesn't contain the
+ * changes and CbmdosFs_status() reports CFS_LAYOUTPENDING. This is much
+ * faster when adding a lot of files, but the image is completely rewritten in
+ * this case, so files will be placed like after CbmdosFs_rewrite(). Don't keep
+ * a pointer to the image across changes, always get it again with
+ * CbmdosFs_image().
+ *
+ * CFF_LAZYCONTENT is only used by CbmdosFs_fromImage(), which then reads
+ * file contents like readCbmdosVfsLazy(). The sector chains of all files are
+ * still followed and checked, but their content is only read when it's first
+ * accessed, so it costs nothing when only the directory is needed. Until
+ * then, the files keep a snapshot of the image (see D64_snapshot()), so
+ * changing the image afterwards is fine, but an image created with
+ * D64_fromBuffer() needs its buffer to stay valid as long as the files exist.
  */
 typedef enum CbmdosFsFlags
 {
@@ -80,6 +107,13 @@ typedef enum CbmdosFsFlags
                                          while chaining a file, still apply
                                          interleave instead of starting at
                                          sector 0 on the new track */
+    CFF_LAZYLAYOUT = 1 << 14,       /**< defer writing changes to the disk
+                                         image until CbmdosFs_flush() */
+    CFF_TALLOC_LOADTIME = 1 << 15,  /**< chain files for the shortest load
+                                         time instead of using the file
+                                         interleave */
+    CFF_LAZYCONTENT = 1 << 16,      /**< when reading from disk image, read
+                                         file contents on first access */
 } CbmdosFsFlags;
 
 /** Filesystem options
@@ -93,6 +127,12 @@ struct CbmdosFsOptions
     uint8_t dirInterleave;          /**< sector interleave to use for
                                          directory */
     uint8_t fileInterleave;         /**< sector interleave to use for files */
+    uint32_t blockTime;             /**< time in microseconds the loader needs
+                                         to handle a block, used with
+                                         CFF_TALLOC_LOADTIME */
+    uint32_t stepTime;              /**< time in microseconds for moving the
+                                         head to the next track, used with
+                                         CFF_TALLOC_LOADTIME */
 };
 
 /** Per file overrides of filesystem options.
@@ -0,0 +1,141 @@
+#ifndef I1541_CBMDOSFSPLAN_H
+#define I1541_CBMDOSFSPLAN_H
+
+/** Declarations for the CbmdosFsPlan class
+ * @file
+ */
+
+#include <stdint.h>
+
+#include <1541img/decl.h>
+
+#include <1541img/cbmdosfsoptions.h>
+
+C_CLASS_DECL(CbmdosFs);
+C_CLASS_DECL(CbmdosFile);
+C_CLASS_DECL(CbmdosVfs);
+
+/** Position of a block on the disk
+ * @struct CbmdosBlockPos cbmdosfsplan.h <1541img/cbmdosfsplan.h>
+ */
+C_CLASS_DECL(CbmdosBlockPos);
+
+struct CbmdosBlockPos
+{
+    uint8_t track;  /**< the track number, starting at 1 */
+    uint8_t sector; /**< the sector number, starting at 0 */
+};
+
+/** A dry run of laying out files on a disk.
+ * This applies exactly the same block allocation rules as CbmdosFs,
+ * including per-file option overrides, but only on a block allocation map.
+ * No sectors are written and no file contents are copied, so it's a very
+ * cheap way to find out which files would fit on a disk and where they
+ * would be placed.
+ *
+ * Adding a file to the plan gives the same placement as appending it to
+ * the CbmdosVfs of a CbmdosFs with the same options.
+ * @class CbmdosFsPlan cbmdosfsplan.h <1541img/cbmdosfsplan.h>
+ */
+C_CLASS_DECL(CbmdosFsPlan);
+
+/** default constructor.
+ * Creates a plan for an empty disk
+ * @memberof CbmdosFsPlan
+ * @param options filesystem options
+ * @returns a newly created CbmdosFsPlan
+ */
+DECLEXPORT CbmdosFsPlan *CbmdosFsPlan_create(CbmdosFsOptions options);
+
+/** Create a plan starting from an existing filesystem.
+ * Files added to the plan are placed in the space left free by the files
+ * already on the filesystem, with the options of the filesystem. The
+ * filesystem isn't modified, so with CFF_LAZYLAYOUT, call CbmdosFs_flush()
+ * first.
+ * @memberof CbmdosFsPlan
+ * @param fs the cbmdos filesystem
+ * @returns a newly created CbmdosFsPlan
+ */
+DECLEXPORT CbmdosFsPlan *CbmdosFsPlan_fromFs(const CbmdosFs *fs);
+
+/** Plan placing a file.
+ * The file is placed after all files already in the plan, like
+ * CbmdosVfs_append() would do.
+ * @memberof CbmdosFsPlan
+ * @param self the plan
+ * @param file the file to place
+ * @returns 0 if the file fits, -1 if it doesn't
+ */
+DECLEXPORT int CbmdosFsPlan_addFile(
+	CbmdosFsPlan *self, const CbmdosFile *file);
+
+/** Plan placing all files of a virtual filesystem.
+ * The files are placed like CbmdosVfs_appendMany() would do. On a plan for
+ * an empty disk, this gives the same placement as CbmdosFs_rewrite().
+ * @memberof CbmdosFsPlan
+ * @param self the plan
+ * @param vfs the virtual filesystem containing the files to place
+ * @returns 0 if all files fit, -1 otherwise
+ */
+DECLEXPORT int CbmdosFsPlan_addVfs(CbmdosFsPlan *self, const CbmdosVfs *vfs);
+
+/** Number of files added to the plan
+ * @memberof CbmdosFsPlan
+ * @param self the plan
+ * @returns the number of files
+ */
+DECLEXPORT unsigned CbmdosFsPlan_fileCount(const CbmdosFsPlan *self);
+
+/** Check whether a file in the plan fits
+ * @memberof CbmdosFsPlan
+ * @param self the plan
+ * @param pos the position of the file in the plan (starting at 0)
+ * @returns 1 if the file fits, 0 if it doesn't or doesn't exist
+ */
+DECLEXPORT int CbmdosFsPlan_fits(const CbmdosFsPlan *self, unsigned pos);
+
+/** Position of the first file in the plan that doesn't fit
+ * @memberof CbmdosFsPlan
+ * @param self the plan
+ * @returns the position of the first file that doesn't fit, or -1 if all
+ *     files fit
+ */
+DECLEXPORT int CbmdosFsPlan_firstFailed(const CbmdosFsPlan *self);
+
+/** The blocks a file in the plan would occupy.
+ * These are the data blocks of the file in the order they are chained.
+ * @memberof CbmdosFsPlan
+ * @param self the plan
+ * @param pos the position of the file in the plan (starting at 0)
+ * @param length the number of blocks is written here
+ * @returns a pointer to the positions of the blocks, or NULL if the file
+ *     doesn't occupy any blocks
+ */
+DECLEXPORT const CbmdosBlockPos *CbmdosFsPlan_chain(
+	const CbmdosFsPlan *self, unsigned pos, unsigned *length);
+
+/** The side sectors a REL file in the plan would occupy
+ * @memberof CbmdosFsPlan
+ * @param self the plan
+ * @param pos the position of the file in the plan (starting at 0)
+ * @param length the number of side sectors is written here
+ * @returns a pointer to the positions of the side sectors, or NULL if the
+ *     file doesn't have side sectors
+ */
+DECLEXPORT const CbmdosBlockPos *CbmdosFsPlan_sideSectors(
+	const CbmdosFsPlan *self, unsigned pos, unsigned *length);
+
+/** Total number of blocks occupied by all files that fit
+ * @memberof CbmdosFsPlan
+ * @param self the plan
+ * @returns the number of blocks, including REL side sectors
+ */
+DECLEXPORT unsigned CbmdosFsPlan_blocks(const CbmdosFsPlan *self);
+
+/** CbmdosFsPlan destructor
+ * @memberof CbmdosFsPlan
+ * @param self the plan
+ */
+DECLEXPORT void CbmdosFsPlan_destroy(CbmdosFsPlan *self);
+
+#endif
@@ -23,6 +23,10 @@ C_CLASS_DECL(Event);
 C_CLASS_DECL(CbmdosInode);
 
 /** The read-only contents of the file
+ * If the contents were read lazily (see readCbmdosVfsLazy()) and weren't
+ * accessed yet, this reads them from the disk image and stores them in the
+ * inode, even though it's passed as const. Calling it for the same inode
+ * from several threads at once must be synchronized.
  * @memberof CbmdosInode
  * @param self the cbmdos file
  * @returns a read-only pointer to the file contents
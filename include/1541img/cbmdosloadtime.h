@@ -0,0 +1,76 @@
+#ifndef I1541_CBMDOSLOADTIME_H
+#define I1541_CBMDOSLOADTIME_H
+
+/** Functions for estimating the time needed to load files from a 1541
+ * @file
+ */
+
+#include <stdint.h>
+
+#include <1541img/decl.h>
+
+C_CLASS_DECL(D64);
+C_CLASS_DECL(CbmdosFs);
+
+/** Timing properties of a drive and the loader used on it.
+ * All times are given in microseconds.
+ *
+ * The load time is modelled by following the sector chain of a file: The
+ * disk rotates continuously and every track starts with sector 0 at the
+ * same rotational position. Sectors are spread evenly over a revolution,
+ * so the time for passing one sector depends on the speed zone of the track
+ * (21, 19, 18 or 17 sectors). After reading a sector, the loader needs
+ * blockTime for decoding and transferring it to the computer before it can
+ * read the next one. If the next sector is on a different track, the head
+ * is moved, taking stepTime per track plus settleTime once.
+ *
+ * Loading starts on track 18 at sector 0, after the directory was read.
+ * @struct CbmdosLoadProfile cbmdosloadtime.h <1541img/cbmdosloadtime.h>
+ */
+C_CLASS_DECL(CbmdosLoadProfile);
+
+struct CbmdosLoadProfile
+{
+    uint32_t rotationTime;  /**< time for one revolution of the disk */
+    uint32_t blockTime;     /**< time needed to handle one block after
+                                 reading it */
+    uint32_t stepTime;      /**< time for moving the head by one track */
+    uint32_t settleTime;    /**< time for the head to settle after moving */
+    uint32_t startTime;     /**< fixed time before loading starts */
+};
+
+/** Profile of the original 1541 DOS and KERNAL loader
+ */
+DECLDATA DECLEXPORT const CbmdosLoadProfile CLP_STOCK;
+
+/** Profile of a typical cartridge or software fastloader
+ */
+DECLDATA DECLEXPORT const CbmdosLoadProfile CLP_FASTLOAD;
+
+/** Profile of a typical IRQ loader as used in demos
+ */
+DECLDATA DECLEXPORT const CbmdosLoadProfile CLP_IRQLOAD;
+
+/** Estimate the time for loading a sector chain.
+ * @param d64 the disk image
+ * @param track the track of the first sector of the chain
+ * @param sector the first sector of the chain
+ * @param profile the drive and loader timing to use
+ * @returns the estimated time in microseconds, or -1 if the chain is broken
+ */
+DECLEXPORT long estimateChainLoadTime(const D64 *d64, uint8_t track,
+	uint8_t sector, const CbmdosLoadProfile *profile);
+
+/** Estimate the time for loading a file from a filesystem.
+ * With CFF_LAZYLAYOUT, this fails while changes are pending, call
+ * CbmdosFs_flush() first.
+ * @param fs the cbmdos filesystem
+ * @param pos the position of the file in the directory (starting at 0)
+ * @param profile the drive and loader timing to use
+ * @returns the estimated time in microseconds, or -1 if the file doesn't
+ *     exist, doesn't occupy any blocks or its chain is broken
+ */
+DECLEXPORT long estimateFileLoadTime(const CbmdosFs *fs, unsigned pos,
+	const CbmdosLoadProfile *profile);
+
+#endif
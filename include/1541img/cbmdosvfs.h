@@ -23,6 +23,16 @@ C_CLASS_DECL(CbmdosFile);
  */
 C_CLASS_DECL(CbmdosVfs);
 
+/** Delegate for comparing two files when sorting a CbmdosVfs
+ * @param a the first file
+ * @param b the second file
+ * @param ctx the context pointer passed to CbmdosVfs_sort()
+ * @returns a value less than, equal to or greater than 0 if a should be
+ *     ordered before, equal to or after b
+ */
+typedef int (*CbmdosFileComparer)(const CbmdosFile *a, const CbmdosFile *b,
+	void *ctx);
+
 /** default constructor.
  * Creates an empty cbmdos vfs
  * @memberof CbmdosVfs
@@ -139,6 +149,20 @@ DECLEXPORT int CbmdosVfs_delete(CbmdosVfs *self, const CbmdosFile *file);
  */
 DECLEXPORT int CbmdosVfs_deleteAt(CbmdosVfs *self, unsigned pos);
 
+/** Delete several files at once
+ * This raises only a single event, so a CbmdosFs attached to the vfs
+ * updates the disc only once. Nothing is deleted if any of the positions
+ * is invalid or given more than once.
+ * @memberof CbmdosVfs
+ * @param self the cbmdos vfs
+ * @param positions positions of the files to delete (starting at 0), in
+ *                  any order
+ * @param count the number of positions
+ * @returns 0 on success, -1 on error
+ */
+DECLEXPORT int CbmdosVfs_deleteMany(
+	CbmdosVfs *self, const unsigned *positions, unsigned count);
+
 /** Append a file to the filesystem
  * @memberof CbmdosVfs
  * @param self the cbmdos vfs
@@ -147,6 +171,19 @@ DECLEXPORT int CbmdosVfs_deleteAt(CbmdosVfs *self, unsigned pos);
  */
 DECLEXPORT int CbmdosVfs_append(CbmdosVfs *self, CbmdosFile *file);
 
+/** Append several files to the filesystem at once
+ * This raises only a single event, so a CbmdosFs attached to the vfs
+ * updates the disc only once. On error, none of the files is appended and
+ * the caller keeps ownership of all of them.
+ * @memberof CbmdosVfs
+ * @param self the cbmdos vfs
+ * @param files the files to append, in order
+ * @param count the number of files
+ * @returns 0 on success, -1 on error
+ */
+DECLEXPORT int CbmdosVfs_appendMany(
+	CbmdosVfs *self, CbmdosFile *const *files, unsigned count);
+
 /** Insert a file at a given position
  * @memberof CbmdosVfs
  * @param self the cbmdos vfs
@@ -170,6 +207,58 @@ DECLEXPORT int CbmdosVfs_insert(
  */
 DECLEXPORT int CbmdosVfs_move(CbmdosVfs *self, unsigned to, unsigned from);
 
+/** Reorder all files at once
+ * This raises only a single event, so a CbmdosFs attached to the vfs
+ * updates the directory only once.
+ * @memberof CbmdosVfs
+ * @param self the cbmdos vfs
+ * @param permutation for each new position, the current position of the
+ *                    file to place there. This must contain every position
+ *                    from 0 to the number of files - 1 exactly once.
+ * @returns 0 on success, -1 on error
+ */
+DECLEXPORT int CbmdosVfs_reorder(
+	CbmdosVfs *self, const unsigned *permutation);
+
+/** Sort all files
+ * The sort is stable, files comparing equal keep their relative order. Like
+ * CbmdosVfs_reorder(), this raises only a single event.
+ * @memberof CbmdosVfs
+ * @param self the cbmdos vfs
+ * @param compare the function comparing two files
+ * @param ctx an optional context pointer passed to the compare function
+ */
+DECLEXPORT void CbmdosVfs_sort(
+	CbmdosVfs *self, CbmdosFileComparer compare, void *ctx);
+
+/** Find a file by name.
+ * The pattern is compared to the raw file names and may contain the
+ * wildcards of CBM DOS: "?" matches any single character and "*" matches
+ * all remaining characters. Without wildcards, the file is found through a
+ * name index instead of comparing every file.
+ * @memberof CbmdosVfs
+ * @param self the cbmdos vfs
+ * @param pattern the name or pattern to search for
+ * @param length the length of the pattern
+ * @returns the position of the first matching file, or -1 if none matches
+ */
+DECLEXPORT int CbmdosVfs_find(
+	const CbmdosVfs *self, const char *pattern, uint8_t length);
+
+/** Find all files matching a name.
+ * Names are matched like in CbmdosVfs_find().
+ * @memberof CbmdosVfs
+ * @param self the cbmdos vfs
+ * @param pattern the name or pattern to search for
+ * @param length the length of the pattern
+ * @param positions the positions of all matching files are written here in
+ *                  ascending order, this must have room for the number of
+ *                  files in the vfs. May be NULL to only count the files.
+ * @returns the number of matching files
+ */
+DECLEXPORT unsigned CbmdosVfs_findAll(const CbmdosVfs *self,
+	const char *pattern, uint8_t length, unsigned *positions);
+
 /** Get the header line of a directory.
  * Gets a header line as displayed in a directory on the C64, without the
  * leading "0 " line number, in PETSCII encoding
@@ -24,14 +24,26 @@ struct CbmdosVfsEventArgs
         CVE_FILEADDED,      /**< a file was added to the filesystem */
         CVE_FILEDELETED,    /**< a file was deleted from the filesystem */
 	CVE_FILEMOVED,	    /**< a file was moved to another position */
-        CVE_FILECHANGED     /**< a file on the filesystem was changed */
+        CVE_FILECHANGED,    /**< a file on the filesystem was changed */
+        CVE_FILESADDED,     /**< several files were appended at once */
+        CVE_FILESDELETED,   /**< several files were deleted at once */
+        CVE_FILESREORDERED  /**< the order of all files changed at once */
     } what;     /**< describes what happened to the vfs */
     const CbmdosFileEventArgs *fileEventArgs;   /**< for changed files, 
                                 a pointer to the corresponding event args */
     unsigned filepos;       /**< for changes concerning a file, the position
-                                 affected by the change */
+                                 affected by the change. For files added
+                                 events, the position of the first added
+                                 file */
     unsigned targetpos;	    /**< for file moved events, the target position
 			         of the moved file */
+    unsigned count;         /**< for events concerning several files, the
+                                 number of files affected */
+    const unsigned *positions;  /**< for files deleted events, the former
+                                 positions of the deleted files in ascending
+                                 order. For files reordered events, the
+                                 former position of the file now found at
+                                 each position */
 };
 
 #endif
@@ -20,12 +20,37 @@ C_CLASS_DECL(CbmdosFsOptions);
  *    vfs.
  * @param d64 the D64 disc image to read from
  * @param options cbmdos filesystem options to use when reading. Probed
- *    options are assumed when passing NULL here.
+ *    options are assumed when passing NULL here. CFF_LAZYCONTENT is
+ *    ignored, the image isn't modified in any way, so all file contents
+ *    are read immediately. Use readCbmdosVfsLazy() instead for reading
+ *    them on first access.
  * @returns 0 on success, -1 on error
  */
 DECLEXPORT int readCbmdosVfs(
 	CbmdosVfs *vfs, const D64 *d64, const CbmdosFsOptions *options);
 
+/** Read a cbmdos vfs from a D64 disc image, reading file contents lazily.
+ * @relatesalso CbmdosVfs
+ *
+ *     #include <1541img/cbmdosvfsreader.h>
+ *
+ * This works like readCbmdosVfs() with CFF_LAZYCONTENT set: the sector
+ * chains of all files are still followed and checked, but their contents are
+ * only read from the image when first accessed. The files keep a snapshot of
+ * the image for that (see D64_snapshot()), so the image may be changed or
+ * destroyed afterwards, but taking the snapshot marks its tracks as shared:
+ * sector content pointers obtained from it before must not be used for
+ * writing afterwards.
+ * @param vfs an empty cbmdos vfs. Reading will fail if you pass a non-empty
+ *    vfs.
+ * @param d64 the D64 disc image to read from
+ * @param options cbmdos filesystem options to use when reading. Probed
+ *    options are assumed when passing NULL here.
+ * @returns 0 on success, -1 on error
+ */
+DECLEXPORT int readCbmdosVfsLazy(
+	CbmdosVfs *vfs, D64 *d64, const CbmdosFsOptions *options);
+
 /** Determine cbmdos fs options needed to read from a D64 disc image.
  * @relatesalso CbmdosFsOptions
  *
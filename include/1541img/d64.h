@@ -5,6 +5,7 @@
  * @file
  */
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include <1541img/decl.h>
@@ -21,7 +22,23 @@ typedef enum D64Type
     D64_42TRACK   /**< extended image with 42 tracks */
 } D64Type;
 
+/** How a D64 constructed from an external buffer treats that buffer
+ */
+typedef enum D64BufferMode
+{
+    D64_BM_READONLY,    /**< the image is read-only, requesting a writable
+                             Track or Sector fails */
+    D64_BM_COPYONWRITE  /**< a track is copied to memory owned by the
+                             image when the content of one of its sectors
+                             is first modified */
+} D64BufferMode;
+
 /** A D64 disk image.
+ * All sectors of the image are kept in a single buffer, laid out exactly like
+ * in a .d64 file. Only when tracks are copied from storage shared with a
+ * snapshot or an external buffer, they may live in a different buffer. The
+ * Track and Sector objects obtained from a D64 are views into this buffer,
+ * they are owned by the D64 and must not be destroyed.
  * @class D64 d64.h <1541img/d64.h>
  */
 C_CLASS_DECL(D64);
@@ -34,6 +51,45 @@ C_CLASS_DECL(D64);
  */
 DECLEXPORT D64 *D64_create(D64Type type);
 
+/** Create a D64 from an existing buffer without copying it.
+ * The D64 directly uses the given buffer as its sector storage, so the
+ * buffer must stay valid and unchanged until the D64 and all snapshots taken
+ * from it (see D64_snapshot()) are destroyed. The buffer is never written
+ * to and never freed by the D64.
+ * @memberof D64
+ * @param buffer the raw contents of a .d64 file
+ * @param size the size of the buffer, must be the size of a valid .d64 file
+ * @param mode what to do when writable access to the image is requested
+ * @returns a newly created D64 image, or NULL on error
+ */
+DECLEXPORT D64 *D64_fromBuffer(const uint8_t *buffer, size_t size,
+	D64BufferMode mode);
+
+/** Create a snapshot of the D64.
+ * The snapshot is a new D64 with the same contents, which initially shares
+ * all sector storage with the original image. A track is only copied when
+ * the content of one of its sectors is modified (see Sector_content()) in
+ * either image, so taking a snapshot doesn't copy any sector data. The
+ * snapshot is independent from the original, each of them may be modified
+ * or destroyed without affecting the other.
+ *
+ * Sector content pointers obtained from the original image before taking
+ * the snapshot must not be used for writing afterwards.
+ * @memberof D64
+ * @param self the D64 image
+ * @returns a newly created D64 image sharing storage with this one
+ */
+DECLEXPORT D64 *D64_snapshot(D64 *self);
+
+/** Check whether the D64 is read-only.
+ * A read-only D64 will refuse to hand out a writable Track or Sector, so
+ * D64_track() and D64_sector() will return NULL.
+ * @memberof D64
+ * @param self the D64 image
+ * @returns 1 if the image is read-only, 0 otherwise
+ */
+DECLEXPORT int D64_readOnly(const D64 *self);
+
 /** Type of the D64
  * @memberof D64
  * @param self the D64 image
@@ -48,6 +104,59 @@ DECLEXPORT D64Type D64_type(const D64 *self);
  */
 DECLEXPORT uint8_t D64_tracks(const D64 *self);
 
+/** Size of the D64 image in bytes.
+ * This is the size of the image when written to a .d64 file.
+ * @memberof D64
+ * @param self the D64 image
+ * @returns the size of this D64 image in bytes
+ */
+DECLEXPORT size_t D64_size(const D64 *self);
+
+/** Check whether a sector was modified.
+ * A sector is marked as dirty whenever its writable content is requested
+ * with Sector_content(). The marks are cleared by D64_clearDirty() and
+ * writeD64Incremental().
+ * @memberof D64
+ * @param self the D64 image
+ * @param tracknum number of the track (starting at 1)
+ * @param sectornum number of the sector (starting at 0)
+ * @returns 1 if the sector is marked as dirty, 0 otherwise
+ */
+DECLEXPORT int D64_sectorDirty(
+	const D64 *self, uint8_t tracknum, uint8_t sectornum);
+
+/** Number of sectors marked as dirty
+ * @memberof D64
+ * @param self the D64 image
+ * @returns the number of sectors currently marked as dirty
+ */
+DECLEXPORT unsigned D64_dirtySectors(const D64 *self);
+
+/** Clear all dirty marks.
+ * Call this after the image was completely saved, e.g. with writeD64().
+ * @memberof D64
+ * @param self the D64 image
+ */
+DECLEXPORT void D64_clearDirty(D64 *self);
+
+/** Compare two D64 images sector by sector.
+ * Sectors both images share storage for (see D64_snapshot()) are known
+ * to be equal without comparing them. If the images have a different number
+ * of tracks, all sectors of the tracks only present in one of them count
+ * as changed.
+ * @memberof D64
+ * @param self the D64 image
+ * @param other the D64 image to compare with
+ * @param changed array of 42 bitmasks receiving the changed sectors, bit n
+ *     of changed[t-1] is set if sector n of track t differs
+ * @param firstdiff optional (may be NULL) array receiving the offset of the
+ *     first differing byte in every changed sector, firstdiff[t-1][n] for
+ *     sector n of track t, 0 for unchanged sectors
+ * @returns the number of changed sectors
+ */
+DECLEXPORT unsigned D64_diff(const D64 *self, const D64 *other,
+	uint32_t changed[42], uint8_t firstdiff[42][21]);
+
 /** Gets a read-only Track
  * @memberof D64
  * @param self the D64 image
@@ -56,11 +165,14 @@ DECLEXPORT uint8_t D64_tracks(const D64 *self);
  */
 DECLEXPORT const Track *D64_rtrack(const D64 *self, uint8_t tracknum);
 
-/** Gets a Track
+/** Gets a Track.
+ * If the sector storage is shared (see D64_BM_COPYONWRITE and
+ * D64_snapshot()), it is copied when the content of a sector is modified.
  * @memberof D64
  * @param self the D64 image
  * @param tracknum number of the track (starting at 1)
- * @returns a pointer to the track (or NULL on error)
+ * @returns a pointer to the track (or NULL on error or if the image is
+ *     read-only)
  */
 DECLEXPORT Track *D64_track(D64 *self, uint8_t tracknum);
 
@@ -74,12 +186,15 @@ DECLEXPORT Track *D64_track(D64 *self, uint8_t tracknum);
 DECLEXPORT const Sector *D64_rsector(
 	const D64 *self, uint8_t tracknum, uint8_t sectornum);
 
-/** Gets a Sector
+/** Gets a Sector.
+ * If the sector storage is shared (see D64_BM_COPYONWRITE and
+ * D64_snapshot()), it is copied when the content of a sector is modified.
  * @memberof D64
  * @param self the D64 image
  * @param tracknum number of the track (starting at 1)
  * @param sectornum number of the sector (starting at 0)
- * @returns a pointer to the sector (or NULL on error)
+ * @returns a pointer to the sector (or NULL on error or if the image is
+ *     read-only)
  */
 DECLEXPORT Sector *D64_sector(D64 *self, uint8_t tracknum, uint8_t sectornum);
 
@@ -9,7 +9,8 @@
 
 #include <1541img/decl.h>
 
-C_CLASS_DECL(D64);
+#include <1541img/d64.h>
+
 C_CLASS_DECL(FileData);
 
 /** Read a D64 disc image from a FileData instance
@@ -17,6 +18,8 @@ C_CLASS_DECL(FileData);
  *
  *     #include <1541img/d64reader.h>
  *
+ * To share identical sectors between many images, use SectorPool_readD64()
+ * instead.
  * @param file a FileData instance to read the disc image from
  * @returns a D64 disc image, or NULL on error
  */
@@ -32,4 +35,21 @@ DECLEXPORT D64 *readD64FromFileData(const FileData *file);
  */
 DECLEXPORT D64 *readD64(FILE *file);
 
+/** Read a D64 disc image by mapping a (host) file into memory.
+ * @relatesalso D64
+ *
+ *     #include <1541img/d64reader.h>
+ *
+ * The file isn't read upfront, its contents are directly used as the
+ * storage of the D64, so only the parts actually accessed are ever loaded.
+ * Changes to the D64 are never written back to the file. With
+ * D64_BM_READONLY, the image is read-only. With D64_BM_COPYONWRITE, only
+ * the parts of the image actually modified are copied. On platforms without
+ * memory mapping support, the file is read into memory instead.
+ * @param filename the name of the file containing the disc image
+ * @param mode whether the image should be read-only or copy-on-write
+ * @returns a D64 disc image, or NULL on error
+ */
+DECLEXPORT D64 *readD64Mapped(const char *filename, D64BufferMode mode);
+
 #endif
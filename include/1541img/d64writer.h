@@ -1,25 +1,70 @@
 #ifndef I1541_D64WRITER_H
 #define I1541_D64WRITER_H
 
-/** Contains a function to write a D64 disc image to a (host) file
+/** Contains functions to write a D64 disc image to a (host) file or memory
  * @file
  */
 
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #include <1541img/decl.h>
 
 C_CLASS_DECL(D64);
+C_CLASS_DECL(FileData);
 
 /** Write a D64 disc image to a (host) file.
  * @relatesalso D64
  *
  *     #include <1541img/d64writer.h>
  *
+ * The whole image is passed to the file in a single write.
  * @param file a file opened for writing to write the disc image to
  * @param d64 the D64 disc image to write
  * @returns 0 on success, -1 on error
  */
 DECLEXPORT int writeD64(FILE *file, const D64 *d64);
 
+/** Write only the modified sectors of a D64 disc image to a (host) file.
+ * @relatesalso D64
+ *
+ *     #include <1541img/d64writer.h>
+ *
+ * This writes every sector marked as dirty (see D64_sectorDirty()) at its
+ * position in the file and then clears all dirty marks of the image. The
+ * file must already contain the complete image as it was when the dirty
+ * marks were last cleared, for example because it was read from this file.
+ * After writing a new file with writeD64(), call D64_clearDirty().
+ * @param file a file opened for reading and writing in binary mode,
+ *     containing the disc image
+ * @param d64 the D64 disc image to write
+ * @returns 0 on success, -1 on error
+ */
+DECLEXPORT int writeD64Incremental(FILE *file, D64 *d64);
+
+/** Write a D64 disc image to a memory buffer.
+ * @relatesalso D64
+ *
+ *     #include <1541img/d64writer.h>
+ *
+ * @param buffer the buffer to write the disc image to
+ * @param size the size of the buffer, must be at least D64_size()
+ * @param d64 the D64 disc image to write
+ * @returns the number of bytes written, or 0 on error
+ */
+DECLEXPORT size_t writeD64ToBuffer(
+	uint8_t *buffer, size_t size, const D64 *d64);
+
+/** Write a D64 disc image to a new FileData instance.
+ * @relatesalso D64
+ *
+ *     #include <1541img/d64writer.h>
+ *
+ * @param d64 the D64 disc image to write
+ * @returns a new FileData instance containing the disc image, or NULL on
+ *     error
+ */
+DECLEXPORT FileData *writeD64ToFileData(const D64 *d64);
+
 #endif
@@ -24,6 +24,12 @@ C_CLASS_DECL(Event);
  */
 C_CLASS_DECL(FileData);
 
+/** Function releasing a buffer adopted by FileData_adopt()
+ * @relatesalso FileData
+ * @param buffer the buffer to release
+ */
+typedef void (*FileDataBufferFree)(void *buffer);
+
 /** default constructor.
  * Creates empty file content
  * @memberof FileData
@@ -39,6 +45,22 @@ DECLEXPORT FileData *FileData_create(void);
  */
 DECLEXPORT FileData *FileData_clone(const FileData *self);
 
+/** Create file content from an existing buffer without copying.
+ * The new FileData takes ownership of the buffer and releases it with the
+ * given function when it's destroyed. If content is appended beyond the
+ * size of the buffer, it's copied to newly allocated memory first and the
+ * buffer is released at that point.
+ * @memberof FileData
+ * @param buffer the buffer containing the content
+ * @param size the size of the content
+ * @param bufferFree function releasing the buffer, e.g. free() for a buffer
+ *     allocated with malloc()
+ * @returns the newly created FileData, or NULL on error (content too large,
+ *     the buffer isn't taken over then)
+ */
+DECLEXPORT FileData *FileData_adopt(uint8_t *buffer, size_t size,
+	FileDataBufferFree bufferFree);
+
 /** The size of the content
  * @memberof FileData
  * @param self the file content
@@ -53,6 +75,16 @@ DECLEXPORT size_t FileData_size(const FileData *self);
  */
 DECLEXPORT const uint8_t *FileData_rcontent(const FileData *self);
 
+/** Reserve space for content.
+ * This makes sure content up to the given size can be appended without
+ * allocating memory again. Use it when the final size is known in advance.
+ * @memberof FileData
+ * @param self the file content
+ * @param size the total size of the content to reserve space for
+ * @returns 0 on success, -1 on error (size too large)
+ */
+DECLEXPORT int FileData_reserve(FileData *self, size_t size);
+
 /** Append a chunk of bytes to the content
  * @memberof FileData
  * @param self the file content
@@ -81,6 +113,24 @@ DECLEXPORT int FileData_appendByte(FileData *self, uint8_t byte);
 DECLEXPORT int FileData_appendBytes(
 	FileData *self, uint8_t byte, size_t count);
 
+/** Start a series of changes to the content.
+ * Until the matching FileData_endUpdate(), changes don't raise the changed
+ * event. Use this when building content in many small steps, so objects
+ * observing the content (like a CbmdosFs containing the file) are only
+ * updated once. Calls can be nested.
+ * @memberof FileData
+ * @param self the file content
+ */
+DECLEXPORT void FileData_beginUpdate(FileData *self);
+
+/** Finish a series of changes to the content.
+ * When this ends the outermost update and the content was changed in the
+ * meantime, the changed event is raised exactly once.
+ * @memberof FileData
+ * @param self the file content
+ */
+DECLEXPORT void FileData_endUpdate(FileData *self);
+
 /** Set a single byte at a given position of the content.
  * The position must already exist.
  * @memberof FileData
@@ -98,6 +148,14 @@ DECLEXPORT int FileData_setByte(FileData *self, uint8_t byte, size_t pos);
  */
 DECLEXPORT Event *FileData_changedEvent(FileData *self);
 
+/** Destroy the FileData, but keep its content.
+ * @memberof FileData
+ * @param self the file content
+ * @param size the size of the content is written here, may be NULL
+ * @returns the content, owned by the caller, who must release it with free()
+ */
+DECLEXPORT uint8_t *FileData_release(FileData *self, size_t *size);
+
 /** FileData destructor
  * @memberof FileData
  * @param self the file content
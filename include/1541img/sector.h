@@ -40,6 +40,10 @@ DECLEXPORT Sector *Sector_createAt(uint8_t tracknum, uint8_t sectornum);
 DECLEXPORT const uint8_t *Sector_rcontent(const Sector *self);
 
 /** Gets the content of the Sector
+ * If the Sector belongs to a D64 sharing its storage with another image or
+ * an external buffer, this first copies the track containing the Sector.
+ * Therefore, pointers to sector content obtained earlier from the same
+ * track may become invalid.
  * @memberof Sector
  * @param self the Sector
  * @returns a pointer to 256 bytes of sector content
@@ -74,7 +78,9 @@ DECLEXPORT void Sector_setTrackNum(Sector *self, uint8_t tracknum);
  */
 DECLEXPORT void Sector_setSectorNum(Sector *self, uint8_t sectornum);
 
-/** Sector destructor
+/** Sector destructor.
+ * Only use this for a Sector created with Sector_create() or
+ * Sector_createAt(), never for a Sector obtained from a Track or a D64.
  * @memberof Sector
  * @param self the Sector
  */
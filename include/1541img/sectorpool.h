@@ -0,0 +1,64 @@
+#ifndef I1541_SECTORPOOL_H
+#define I1541_SECTORPOOL_H
+
+/** Declarations for the SectorPool class
+ * @file
+ */
+
+#include <stddef.h>
+
+#include <1541img/decl.h>
+
+C_CLASS_DECL(D64);
+C_CLASS_DECL(FileData);
+
+/** A pool of sectors shared by many D64 images.
+ * Images read through a SectorPool don't get their own sector storage,
+ * instead every distinct sector content is stored only once in the pool and
+ * shared by all images containing it. This saves a lot of memory when
+ * many images are kept in memory, as sectors filled with zeros or some
+ * pattern, as well as identical BAM or loader sectors, are very common.
+ *
+ * The shared sectors are never modified, when the content of a sector of
+ * such an image is modified, the image copies the whole track containing
+ * it to storage of its own.
+ *
+ * The pool and all images read through it must be used from the same
+ * thread.
+ * @class SectorPool sectorpool.h <1541img/sectorpool.h>
+ */
+C_CLASS_DECL(SectorPool);
+
+/** default constructor.
+ * Creates an empty sector pool
+ * @memberof SectorPool
+ * @returns a newly created SectorPool
+ */
+DECLEXPORT SectorPool *SectorPool_create(void);
+
+/** Read a D64 disc image from a FileData instance into the pool.
+ * This works like readD64FromFileData(), but the sectors of the image are
+ * stored in the pool.
+ * @memberof SectorPool
+ * @param self the SectorPool
+ * @param file a FileData instance to read the disc image from
+ * @returns a D64 disc image, or NULL on error
+ */
+DECLEXPORT D64 *SectorPool_readD64(SectorPool *self, const FileData *file);
+
+/** Number of distinct sectors stored in the pool
+ * @memberof SectorPool
+ * @param self the SectorPool
+ * @returns the number of distinct sectors currently stored
+ */
+DECLEXPORT size_t SectorPool_sectors(const SectorPool *self);
+
+/** SectorPool destructor.
+ * Images read through the pool stay valid, the memory of the pool is
+ * released when the last of these images is destroyed.
+ * @memberof SectorPool
+ * @param self the SectorPool
+ */
+DECLEXPORT void SectorPool_destroy(SectorPool *self);
+
+#endif
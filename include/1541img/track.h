@@ -53,7 +53,9 @@ DECLEXPORT uint8_t Track_trackNum(const Track *self);
  */
 DECLEXPORT uint8_t Track_sectors(const Track *self);
 
-/** Track destructor
+/** Track destructor.
+ * Only use this for a Track created with Track_create(), never for a Track
+ * obtained from a D64.
  * @memberof Track
  * @param self the Track
  */
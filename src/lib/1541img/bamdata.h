@@ -0,0 +1,67 @@
+#ifndef BAMDATA_H
+#define BAMDATA_H
+
+#include <stdint.h>
+
+/* Block allocation maps hold one bitmask per track, bit n is set if
+ * sector n is in use. */
+
+static inline uint8_t bamTrackSectors(uint8_t trackno)
+{
+    if (trackno < 18) return 21;
+    if (trackno < 25) return 19;
+    if (trackno < 31) return 18;
+    return 17;
+}
+
+static inline uint32_t bamTrackMask(uint8_t sectors)
+{
+    return (1U << sectors) - 1;
+}
+
+static inline int bamUsed(const uint32_t *bam, uint8_t trackno,
+	uint8_t sectno)
+{
+    return sectno < 21 && ((bam[trackno-1] >> sectno) & 1U);
+}
+
+static inline void bamAllocate(uint32_t *bam, uint8_t trackno,
+	uint8_t sectno)
+{
+    bam[trackno-1] |= 1U << sectno;
+}
+
+static inline void bamRelease(uint32_t *bam, uint8_t trackno,
+	uint8_t sectno)
+{
+    bam[trackno-1] &= ~(1U << sectno);
+}
+
+static inline unsigned bamCount(uint32_t bits)
+{
+#ifdef __GNUC__
+    return (unsigned)__builtin_popcount(bits);
+#else
+    unsigned count = 0;
+    for (; bits; bits &= bits - 1) ++count;
+    return count;
+#endif
+}
+
+/* number of the lowest set bit, bits must not be 0 */
+static inline uint8_t bamFirst(uint32_t bits)
+{
+#ifdef __GNUC__
+    return (uint8_t)__builtin_ctz(bits);
+#else
+    uint8_t pos = 0;
+    while (!(bits & 1U))
+    {
+	bits >>= 1;
+	++pos;
+    }
+    return pos;
+#endif
+}
+
+#endif
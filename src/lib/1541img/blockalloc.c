@@ -0,0 +1,282 @@
+#include "bamdata.h"
+
+#include "blockalloc.h"
+
+SOLOCAL uint8_t freeSectorOnTrack(const uint32_t *bam, uint8_t trackno,
+        uint8_t sectno, uint8_t interlv, int simpleInterlv)
+{
+    uint8_t sectors = bamTrackSectors(trackno);
+    uint8_t nextsect = 0;
+    if (interlv)
+    {
+	if (simpleInterlv)
+	{
+	    nextsect = (sectno + interlv) % sectors;
+	}
+	else
+	{
+	    nextsect = sectno + interlv;
+	    if (nextsect >= sectors)
+	    {
+		nextsect -= sectors;
+		if (nextsect) --nextsect;
+	    }
+	}
+    }
+    uint32_t freemap = ~bam[trackno-1] & bamTrackMask(sectors);
+    if (!freemap) return 0xff;
+    uint32_t ahead = freemap >> nextsect;
+    if (ahead) return nextsect + bamFirst(ahead);
+    return bamFirst(freemap);
+}
+
+/* time for one revolution of the disk at 300 rpm, in microseconds */
+#define ROTATIONTIME 200000ULL
+
+static uint8_t loadTimeSector(const uint32_t *bam, uint8_t fromtrack,
+	uint8_t fromsect, uint8_t trackno, const CbmdosFsOptions *opts)
+{
+    /* sectors are assumed to be spread evenly over a revolution, starting
+     * at the same position on every track. The previous block is handled
+     * after reading it, so the drive is ready at the end of the previous
+     * sector plus blockTime, and stepTime later when changing the track.
+     * Pick the first free sector starting after that, scaled to the
+     * sectors of the target track. */
+    uint8_t fromsectors = bamTrackSectors(fromtrack);
+    uint8_t sectors = bamTrackSectors(trackno);
+    unsigned long long ready = (fromsect + 1) * ROTATIONTIME
+	+ (unsigned long long)opts->blockTime * fromsectors;
+    if (trackno != fromtrack)
+    {
+	ready += (unsigned long long)opts->stepTime * fromsectors;
+    }
+    unsigned long long unit = ROTATIONTIME * fromsectors;
+    uint8_t nextsect = (uint8_t)(((ready * sectors + unit - 1) / unit)
+	    % sectors);
+
+    uint32_t freemap = ~bam[trackno-1] & bamTrackMask(sectors);
+    if (!freemap) return 0xff;
+    uint32_t ahead = freemap >> nextsect;
+    if (ahead) return nextsect + bamFirst(ahead);
+    return bamFirst(freemap);
+}
+
+SOLOCAL uint8_t nextTrack(const CbmdosFsOptions *opts, uint8_t trackno)
+{
+    if (opts->flags & CFF_TALLOC_TRACKLOAD)
+    {
+	if (trackno >= 40 && !(opts->flags & CFF_42TRACK))
+	{
+	    return 0;
+	}
+	if (trackno >= 35 &&
+		!(opts->flags & (CFF_40TRACK | CFF_42TRACK)))
+	{
+	    return 0;
+	}
+	if (trackno == 42) return 0;
+	if (trackno == 17)
+	{
+	    if ((opts->flags & CFF_FILESONDIRTRACK) &&
+		    !(opts->flags & CFF_TALLOC_PREFDIRTRACK))
+	    {
+		return 18;
+	    }
+	    return 19;
+	}
+	if (trackno == 18
+		&& (opts->flags & CFF_FILESONDIRTRACK)
+		&& (opts->flags & CFF_TALLOC_PREFDIRTRACK))
+	{
+	    return 1;
+	}
+	return trackno + 1;
+    }
+    else if (opts->flags & CFF_TALLOC_SIMPLE)
+    {
+	if (trackno == 42)
+	{
+	    if ((opts->flags & CFF_FILESONDIRTRACK) &&
+		    !(opts->flags & CFF_TALLOC_PREFDIRTRACK))
+	    {
+		return 18;
+	    }
+	    return 0;
+	}
+	if (trackno == 40 || (trackno == 35 && !(opts->flags &
+			(CFF_40TRACK | CFF_42TRACK))))
+	{
+	    return 1;
+	}
+	if (trackno == 17)
+	{
+	    if (opts->flags & CFF_42TRACK)
+	    {
+		return 41;
+	    }
+	    if ((opts->flags & CFF_FILESONDIRTRACK) &&
+		    !(opts->flags & CFF_TALLOC_PREFDIRTRACK))
+	    {
+		return 18;
+	    }
+	    return 0;
+	}
+	if (trackno == 18)
+	{
+	    if ((opts->flags & CFF_FILESONDIRTRACK)
+		    && (opts->flags & CFF_TALLOC_PREFDIRTRACK))
+	    {
+		return 19;
+	    }
+	    return 0;
+	}
+	return trackno + 1;
+    }
+    else
+    {
+	if (trackno >= 40 && !(opts->flags & CFF_42TRACK))
+	{
+	    return 0;
+	}
+	if (trackno >= 35 &&
+		!(opts->flags & (CFF_40TRACK | CFF_42TRACK)))
+	{
+	    return 0;
+	}
+	if (trackno == 42) return 0;
+	if (trackno == 1) return 0;
+	if (trackno == 18)
+	{
+	    if ((opts->flags & CFF_FILESONDIRTRACK)
+		    && (opts->flags & CFF_TALLOC_PREFDIRTRACK))
+	    {
+		return 17;
+	    }
+	    return 0;
+	}
+	if (trackno < 18) return trackno - 1;
+	return trackno + 1;
+    }
+}
+
+static uint8_t startTrack(const CbmdosFsOptions *opts, uint8_t trackno)
+{
+    if (!trackno)
+    {
+	if ((opts->flags & CFF_FILESONDIRTRACK)
+		&& (opts->flags & CFF_TALLOC_PREFDIRTRACK))
+	{
+	    return 18;
+	}
+	if (opts->flags & CFF_TALLOC_TRACKLOAD)
+	{
+	    return 1;
+	}
+	if (opts->flags & CFF_TALLOC_SIMPLE)
+	{
+	    return 19;
+	}
+	return 17;
+    }
+    if (opts->flags & (CFF_TALLOC_TRACKLOAD | CFF_TALLOC_SIMPLE))
+    {
+	return nextTrack(opts, trackno);
+    }
+    if (trackno >= 40 && !(opts->flags & CFF_42TRACK))
+    {
+	return 0;
+    }
+    if (trackno >= 35)
+    {
+	if (!(opts->flags & (CFF_40TRACK | CFF_42TRACK)))
+	{
+	    return 0;
+	}
+	return trackno + 1;
+    }
+    int diff = 18 - trackno;
+    if (!diff) return 17;
+    if (diff > 0) return 18 + diff;
+    return 18 + diff - 1;
+}
+
+SOLOCAL int findStartSector(const uint32_t *bam,
+        uint8_t *trackno, uint8_t *sectno, const CbmdosFsOptions *opts)
+{
+    uint8_t tn = startTrack(opts, 0);
+    do
+    {
+	uint32_t freemap = ~bam[tn-1] & bamTrackMask(bamTrackSectors(tn));
+	if (freemap)
+	{
+	    *trackno = tn;
+	    *sectno = bamFirst(freemap);
+	    return 0;
+	}
+    } while ((tn = startTrack(opts, tn)));
+    return -1;
+}
+
+SOLOCAL int findNextSector(const uint32_t *bam,
+        uint8_t *trackno, uint8_t *sectno, const CbmdosFsOptions *opts)
+{
+    uint8_t tn = *trackno;
+    uint8_t sn;
+    if (opts->flags & CFF_TALLOC_LOADTIME)
+    {
+	sn = loadTimeSector(bam, *trackno, *sectno, tn, opts);
+    }
+    else
+    {
+	sn = freeSectorOnTrack(bam, tn, *sectno, opts->fileInterleave,
+		(opts->flags & CFF_SIMPLEINTERLEAVE));
+    }
+    do
+    {
+	if (sn != 0xff)
+	{
+	    *trackno = tn;
+	    *sectno = sn;
+	    return 0;
+	}
+	if ((tn = nextTrack(opts, tn)))
+	{
+	    if (opts->flags & CFF_TALLOC_LOADTIME)
+	    {
+		sn = loadTimeSector(bam, *trackno, *sectno, tn, opts);
+	    }
+	    else if (opts->flags & CFF_TALLOC_CHAININTERLV)
+	    {
+		sn = freeSectorOnTrack(bam, tn, sn, opts->fileInterleave,
+                        (opts->flags & CFF_SIMPLEINTERLEAVE));
+	    }
+	    else
+	    {
+		sn = freeSectorOnTrack(bam, tn, sn, 0, 0);
+	    }
+	}
+    } while (tn);
+    return findStartSector(bam, trackno, sectno, opts);
+}
+
+SOLOCAL int findDirSector(const uint32_t *bam,
+	uint8_t *trackno, uint8_t *sectno, const CbmdosFsOptions *opts)
+{
+    uint8_t tn = *trackno;
+    uint8_t sn = freeSectorOnTrack(bam, tn, *sectno, opts->dirInterleave,
+	    (opts->flags & CFF_SIMPLEINTERLEAVE));
+    if (sn == 0xff)
+    {
+	if (!(opts->flags & CFF_ALLOWLONGDIR)) return -1;
+	while (sn == 0xff)
+	{
+	    tn = nextTrack(opts, tn);
+	    if (!tn || tn == 18) return -1;
+	    sn = freeSectorOnTrack(bam, tn, *sectno, opts->dirInterleave,
+		    (opts->flags & CFF_SIMPLEINTERLEAVE));
+	}
+    }
+    *trackno = tn;
+    *sectno = sn;
+    return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef BLOCKALLOC_H
+#define BLOCKALLOC_H
+
+#include <stdint.h>
+
+#include <1541img/cbmdosfsoptions.h>
+
+/* Block allocation strategies working on a block allocation map only, see
+ * bamdata.h. They find free sectors, but never allocate them. */
+
+uint8_t freeSectorOnTrack(const uint32_t *bam, uint8_t trackno,
+	uint8_t sectno, uint8_t interlv, int simpleInterlv);
+uint8_t nextTrack(const CbmdosFsOptions *opts, uint8_t trackno);
+int findStartSector(const uint32_t *bam,
+	uint8_t *trackno, uint8_t *sectno, const CbmdosFsOptions *opts);
+int findNextSector(const uint32_t *bam,
+	uint8_t *trackno, uint8_t *sectno, const CbmdosFsOptions *opts);
+
+/* find the next sector for a directory, starting from the last sector of
+ * the directory given in trackno and sectno */
+int findDirSector(const uint32_t *bam,
+	uint8_t *trackno, uint8_t *sectno, const CbmdosFsOptions *opts);
+
+#endif
@@ -0,0 +1,96 @@
+#include <string.h>
+
+#include "log.h"
+#include "bamdata.h"
+#include "d64.h"
+
+#include <1541img/cbmdosdiriter.h>
+
+static const uint8_t *sectorBytes(const CbmdosDirIter *self,
+	uint8_t track, uint8_t sector)
+{
+    size_t offset = sector;
+    for (uint8_t t = 1; t < track; ++t) offset += bamTrackSectors(t);
+    return self->image + offset * 256;
+}
+
+static int enterSector(CbmdosDirIter *self, uint8_t track, uint8_t sector)
+{
+    if (!track || track > self->tracks || sector >= bamTrackSectors(track))
+    {
+	logmsg(L_WARNING, "CbmdosDirIter: invalid directory sector.");
+	return -1;
+    }
+    if (track != 18 && !(self->flags & CFF_ALLOWLONGDIR))
+    {
+	logmsg(L_WARNING, "CbmdosDirIter: unexpectedly found long "
+		"directory.");
+	return -1;
+    }
+    if (bamUsed(self->visited, track, sector))
+    {
+	logmsg(L_WARNING, "CbmdosDirIter: directory contains a loop.");
+	return -1;
+    }
+    bamAllocate(self->visited, track, sector);
+    self->track = track;
+    self->sector = sector;
+    self->pos = 0;
+    return 0;
+}
+
+SOEXPORT int CbmdosDirIter_init(CbmdosDirIter *self,
+	const uint8_t *image, size_t size, CbmdosFsFlags flags)
+{
+    D64Type type;
+    if (D64_typeForSize(&type, size) < 0)
+    {
+	logmsg(L_ERROR, "CbmdosDirIter_init: not a valid D64 image size.");
+	return -1;
+    }
+    memset(self, 0, sizeof *self);
+    self->image = image;
+    self->flags = flags;
+    self->tracks = type == D64_42TRACK ? 42 : type == D64_40TRACK ? 40 : 35;
+    return enterSector(self, 18, 1);
+}
+
+SOEXPORT int CbmdosDirIter_next(CbmdosDirIter *self, CbmdosDirEntry *entry)
+{
+    while (self->track)
+    {
+	const uint8_t *dirbytes = sectorBytes(self, self->track, self->sector);
+	while (self->pos < 8)
+	{
+	    const uint8_t *direntry = dirbytes + 0x20 * self->pos++;
+	    if (!direntry[2]) continue;
+
+	    uint8_t namelen = 16;
+	    while (namelen && direntry[namelen + 4] == 0xa0) --namelen;
+	    memcpy(entry->name, direntry + 5, namelen);
+	    entry->name[namelen] = 0;
+	    entry->nameLength = namelen;
+	    entry->type = direntry[2] & 0xf;
+	    entry->locked = !!(direntry[2] & (1<<6));
+	    entry->closed = !!(direntry[2] & (1<<7));
+	    entry->blocks = (direntry[0x1f] << 8) | direntry[0x1e];
+	    entry->track = direntry[3];
+	    entry->sector = direntry[4];
+	    entry->sideTrack = direntry[0x15];
+	    entry->sideSector = direntry[0x16];
+	    entry->recordLength = direntry[0x17];
+	    return 1;
+	}
+	if (!dirbytes[0])
+	{
+	    self->track = 0;
+	    break;
+	}
+	if (enterSector(self, dirbytes[0], dirbytes[1]) < 0)
+	{
+	    self->track = 0;
+	    return -1;
+	}
+    }
+    return 0;
+}
@@ -10,7 +10,7 @@
 #include <1541img/hostfilewriter.h>
 #include <1541img/petscii.h>
 
-#include <1541img/cbmdosfile.h>
+#include "cbmdosfile.h"
 
 static const char *exts[] =
 {
@@ -32,6 +32,7 @@ struct CbmdosFile
     Event *changedEvent;
     char *name;
     CbmdosInode *inode;
+    CbmdosFileVfsLink vfsLink;
     CbmdosFileType type;
     int invalidType;
     int locked;
@@ -94,6 +95,7 @@ SOEXPORT CbmdosFile *CbmdosFile_clone(const CbmdosFile *other)
     self->autoMapToLc = 0;
     self->name = 0;
     self->inode = CbmdosInode_clone(other->inode);
+    memset(&self->vfsLink, 0, sizeof self->vfsLink);
     self->changedEvent = Event_create(0, self);
     self->nameLength = 0;
     self->recordLength = other->recordLength;
@@ -147,6 +149,22 @@ SOEXPORT int CbmdosFile_setType(CbmdosFile *self, CbmdosFileType type)
     return rc;
 }
 
+SOLOCAL const CbmdosFileVfsLink *CbmdosFile_rvfsLink(const CbmdosFile *self)
+{
+    return &self->vfsLink;
+}
+
+SOLOCAL CbmdosFileVfsLink *CbmdosFile_vfsLink(CbmdosFile *self)
+{
+    return &self->vfsLink;
+}
+
+SOLOCAL void CbmdosFile_setChain(CbmdosFile *self, CbmdosInodeSource *source,
+	uint8_t track, uint8_t sector, size_t size)
+{
+    CbmdosInode_setChain(self->inode, source, track, sector, size);
+}
+
 SOEXPORT const char *CbmdosFile_name(const CbmdosFile *self, uint8_t *length)
 {
     if (length)
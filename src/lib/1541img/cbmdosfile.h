@@ -0,0 +1,27 @@
+#ifndef CBMDOSFILE_H
+#define CBMDOSFILE_H
+
+#include <stddef.h>
+
+#include <1541img/cbmdosfile.h>
+
+#include "cbmdosinode.h"
+
+/* data kept by the CbmdosVfs a file belongs to: the position of the file
+ * and its entry in the name index of the vfs */
+typedef struct CbmdosFileVfsLink
+{
+    CbmdosFile *next;
+    unsigned pos;
+    uint32_t hash;
+} CbmdosFileVfsLink;
+
+const CbmdosFileVfsLink *CbmdosFile_rvfsLink(const CbmdosFile *self);
+CbmdosFileVfsLink *CbmdosFile_vfsLink(CbmdosFile *self);
+
+/* lets the content be read lazily from a sector chain, see
+ * CbmdosInode_setChain() */
+void CbmdosFile_setChain(CbmdosFile *self, CbmdosInodeSource *source,
+	uint8_t track, uint8_t sector, size_t size);
+
+#endif
@@ -4,22 +4,30 @@
 #include "util.h"
 #include "log.h"
 #include "dirdata.h"
+#include "bamdata.h"
+#include "blockalloc.h"
 #include "cbmdosvfsreader.h"
-#include <1541img/d64.h>
+#include "d64.h"
 #include <1541img/track.h>
 #include <1541img/sector.h>
 #include <1541img/cbmdosfile.h>
 #include <1541img/cbmdosvfs.h>
 #include <1541img/cbmdosvfseventargs.h>
+#include <1541img/cbmdosfsplan.h>
 #include <1541img/filedata.h>
 #include <1541img/event.h>
 
-#include <1541img/cbmdosfs.h>
+#include "cbmdosfs.h"
+
+/* number of sectors of a 42 tracks image */
+#define MAXBLOCKS 802
 
 const CbmdosFsOptions CFO_DEFAULT = {
     .flags = CFF_COMPATIBLE,
     .dirInterleave = 3,
-    .fileInterleave = 10
+    .fileInterleave = 10,
+    .blockTime = 18000,
+    .stepTime = 8000
 };
 
 struct CbmdosFs
@@ -29,59 +37,57 @@ struct CbmdosFs
     DirData dir;
     CbmdosFsStatus status;
     CbmdosFsOptions options;
-    uint8_t bam[42][21];
+    uint32_t bam[42];
+    uint32_t bamwritten[42];
+    int bamstale;
+    int dirstale;
+    int layoutstale;
+    int blocksstale;
+    unsigned long usedblocks;
 };
 
 static void createTrackBam(CbmdosFs *self, uint8_t *tbam, uint8_t trackno)
 {
-    uint8_t sectors = Track_sectors(D64_track(self->d64, trackno));
-    tbam[0] = sectors;
-    tbam[1] = 0xff;
-    tbam[2] = 0xff;
-    tbam[3] = 0xff >> (24 - sectors);
-    for (uint8_t sectno = 0; sectno < sectors; ++sectno)
-    {
-        if (self->bam[trackno-1][sectno])
-        {
-            --tbam[0];
-            tbam[1+sectno/8] ^= (1U << (sectno%8));
-        }
-    }
+    uint8_t sectors = Track_sectors(D64_rtrack(self->d64, trackno));
+    uint32_t freemap = ~self->bam[trackno-1] & bamTrackMask(sectors);
+    tbam[0] = bamCount(freemap);
+    tbam[1] = freemap & 0xff;
+    tbam[2] = (freemap >> 8) & 0xff;
+    tbam[3] = freemap >> 16;
     if (self->options.flags & CFF_ZEROFREE)
     {
 	tbam[0] = 0;
     }
 }
 
-static void updateBam(CbmdosFs *self)
+static void writeTrackBam(CbmdosFs *self, uint8_t *bam, uint8_t trackno)
+{
+    if (trackno < 36)
+    {
+	createTrackBam(self, bam + 4*trackno, trackno);
+    }
+    else if (trackno < 41)
+    {
+	if (self->options.flags & CFF_DOLPHINDOSBAM)
+	{
+	    createTrackBam(self, bam + 0x1c + 4*trackno, trackno);
+	}
+	if (self->options.flags & CFF_SPEEDDOSBAM)
+	{
+	    createTrackBam(self, bam + 0x30 + 4*trackno, trackno);
+	}
+	if (self->options.flags & CFF_PROLOGICDOSBAM)
+	{
+	    createTrackBam(self, bam + 4*trackno, trackno);
+	}
+    }
+}
+
+static void writeBamHeader(CbmdosFs *self, uint8_t *bam)
 {
-    uint8_t *bam = Sector_content(D64_sector(self->d64, 18, 0));
-    memset(bam, 0, 256);
     bam[0] = 18;
     bam[1] = 1;
     bam[2] = CbmdosVfs_dosver(self->vfs);
-    for (uint8_t trackno = 1; trackno <= D64_tracks(self->d64); ++trackno)
-    {
-        if (trackno < 36)
-        {
-            createTrackBam(self, bam + 4*trackno, trackno);
-        }
-        else if (trackno < 41)
-        {
-            if (self->options.flags & CFF_DOLPHINDOSBAM)
-            {
-                createTrackBam(self, bam + 0x1c + 4*trackno, trackno);
-            }
-            if (self->options.flags & CFF_SPEEDDOSBAM)
-            {
-                createTrackBam(self, bam + 0x30 + 4*trackno, trackno);
-            }
-            if (self->options.flags & CFF_PROLOGICDOSBAM)
-            {
-                createTrackBam(self, bam + 4*trackno, trackno);
-            }
-        }
-    }
     uint8_t nameoffset = 0;
     if (self->options.flags & CFF_PROLOGICDOSBAM) nameoffset = 0x14;
     memset(bam+0x90+nameoffset, 0xa0, 0x1b);
@@ -94,9 +100,51 @@ static void updateBam(CbmdosFs *self)
     memcpy(bam+0xa2+nameoffset, id, length);
 }
 
-static void deleteChain(CbmdosFs *self, uint8_t nexttrack, uint8_t nextsect)
+static void updateBam(CbmdosFs *self)
+{
+    uint8_t *bam = Sector_content(D64_sector(self->d64, 18, 0));
+    memset(bam, 0, 256);
+    writeBamHeader(self, bam);
+    for (uint8_t trackno = 1; trackno <= D64_tracks(self->d64); ++trackno)
+    {
+	writeTrackBam(self, bam, trackno);
+    }
+    memcpy(self->bamwritten, self->bam, sizeof self->bamwritten);
+    self->bamstale = 0;
+}
+
+static void updateBamHeader(CbmdosFs *self)
 {
-    if (self->bam[nexttrack-1][nextsect] != 1) return;
+    if (self->bamstale)
+    {
+	updateBam(self);
+	return;
+    }
+    writeBamHeader(self, Sector_content(D64_sector(self->d64, 18, 0)));
+}
+
+/* write only the BAM entries of tracks with changed allocation */
+static void flushBam(CbmdosFs *self)
+{
+    if (self->bamstale)
+    {
+	updateBam(self);
+	return;
+    }
+    uint8_t *bam = 0;
+    for (uint8_t trackno = 1; trackno <= D64_tracks(self->d64); ++trackno)
+    {
+	if (self->bam[trackno-1] == self->bamwritten[trackno-1]) continue;
+	if (!bam) bam = Sector_content(D64_sector(self->d64, 18, 0));
+	writeTrackBam(self, bam, trackno);
+	self->bamwritten[trackno-1] = self->bam[trackno-1];
+    }
+}
+
+static void releaseChain(const D64 *d64, uint32_t *bam,
+	uint8_t nexttrack, uint8_t nextsect)
+{
+    if (!bamUsed(bam, nexttrack, nextsect)) return;
     do
     {
         if (nexttrack == 18 && nextsect == 0)
@@ -104,302 +152,153 @@ static void deleteChain(CbmdosFs *self, uint8_t nexttrack, uint8_t nextsect)
             logmsg(L_WARNING, "CbmdosFs: refusing to delete BAM at [18:0]");
             return;
         }
-        uint8_t *dir = Sector_content(
-                D64_sector(self->d64, nexttrack, nextsect));
-        self->bam[nexttrack-1][nextsect] = 0;
+        const uint8_t *dir = Sector_rcontent(
+                D64_rsector(d64, nexttrack, nextsect));
+        bamRelease(bam, nexttrack, nextsect);
         nexttrack = dir[0];
         nextsect = dir[1];
-    } while (nexttrack && self->bam[nexttrack-1][nextsect] == 1);
+    } while (nexttrack && bamUsed(bam, nexttrack, nextsect));
 }
 
-static uint8_t freeSectorOnTrack(CbmdosFs *self, uint8_t trackno,
-        uint8_t sectno, uint8_t interlv, int simpleInterlv)
+static void deleteChain(CbmdosFs *self, uint8_t nexttrack, uint8_t nextsect)
 {
-    uint8_t sectors = Track_sectors(D64_track(self->d64, trackno));
-    uint8_t nextsect = 0;
-    if (interlv)
-    {
-	if (simpleInterlv)
-	{
-	    nextsect = (sectno + interlv) % sectors;
-	}
-	else
-	{
-	    nextsect = sectno + interlv;
-	    if (nextsect >= sectors)
-	    {
-		nextsect -= sectors;
-		if (nextsect) --nextsect;
-	    }
-	}
-    }
-    uint8_t tmp = nextsect;
-    while (self->bam[trackno-1][nextsect])
-    {
-        ++nextsect;
-        if (nextsect == sectors) nextsect = 0;
-        if (nextsect == tmp) break;
-    }
-    return self->bam[trackno-1][nextsect] ? 0xff : nextsect;
+    releaseChain(self->d64, self->bam, nexttrack, nextsect);
 }
 
-static uint8_t nextTrack(const CbmdosFsOptions *opts, uint8_t trackno)
+static void appendDirSector(CbmdosFs *self, uint8_t trackno, uint8_t sectno)
 {
-    if (opts->flags & CFF_TALLOC_TRACKLOAD)
+    if (self->dir.chainsize == self->dir.chaincapa)
     {
-	if (trackno >= 40 && !(opts->flags & CFF_42TRACK))
-	{
-	    return 0;
-	}
-	if (trackno >= 35 &&
-		!(opts->flags & (CFF_40TRACK | CFF_42TRACK)))
-	{
-	    return 0;
-	}
-	if (trackno == 42) return 0;
-	if (trackno == 17)
-	{
-	    if ((opts->flags & CFF_FILESONDIRTRACK) &&
-		    !(opts->flags & CFF_TALLOC_PREFDIRTRACK))
-	    {
-		return 18;
-	    }
-	    return 19;
-	}
-	if (trackno == 18
-		&& (opts->flags & CFF_FILESONDIRTRACK)
-		&& (opts->flags & CFF_TALLOC_PREFDIRTRACK))
-	{
-	    return 1;
-	}
-	return trackno + 1;
-    }
-    else if (opts->flags & CFF_TALLOC_SIMPLE)
-    {
-	if (trackno == 42)
-	{
-	    if ((opts->flags & CFF_FILESONDIRTRACK) &&
-		    !(opts->flags & CFF_TALLOC_PREFDIRTRACK))
-	    {
-		return 18;
-	    }
-	    return 0;
-	}
-	if (trackno == 40 || (trackno == 35 && !(opts->flags &
-			(CFF_40TRACK | CFF_42TRACK))))
-	{
-	    return 1;
-	}
-	if (trackno == 17)
-	{
-	    if (opts->flags & CFF_42TRACK)
-	    {
-		return 41;
-	    }
-	    if ((opts->flags & CFF_FILESONDIRTRACK) &&
-		    !(opts->flags & CFF_TALLOC_PREFDIRTRACK))
-	    {
-		return 18;
-	    }
-	    return 0;
-	}
-	if (trackno == 18)
-	{
-	    if ((opts->flags & CFF_FILESONDIRTRACK)
-		    && (opts->flags & CFF_TALLOC_PREFDIRTRACK))
-	    {
-		return 19;
-	    }
-	    return 0;
-	}
-	return trackno + 1;
-    }
-    else
-    {
-	if (trackno >= 40 && !(opts->flags & CFF_42TRACK))
-	{
-	    return 0;
-	}
-	if (trackno >= 35 &&
-		!(opts->flags & (CFF_40TRACK | CFF_42TRACK)))
-	{
-	    return 0;
-	}
-	if (trackno == 42) return 0;
-	if (trackno == 1) return 0;
-	if (trackno == 18)
-	{
-	    if ((opts->flags & CFF_FILESONDIRTRACK)
-		    && (opts->flags & CFF_TALLOC_PREFDIRTRACK))
-	    {
-		return 17;
-	    }
-	    return 0;
-	}
-	if (trackno < 18) return trackno - 1;
-	return trackno + 1;
+	self->dir.chaincapa += DIRSECTCHUNK;
+	self->dir.chain = xrealloc(self->dir.chain,
+		self->dir.chaincapa * sizeof *self->dir.chain);
     }
+    self->dir.chain[self->dir.chainsize].track = trackno;
+    self->dir.chain[self->dir.chainsize].sector = sectno;
+    ++self->dir.chainsize;
+    bamAllocate(self->bam, trackno, sectno);
+    uint8_t *dir = Sector_content(D64_sector(self->d64, trackno, sectno));
+    memset(dir, 0, 256);
+    dir[1] = 0xff;
 }
 
-static uint8_t startTrack(const CbmdosFsOptions *opts, uint8_t trackno)
+static int extendDir(CbmdosFs *self, unsigned sectors)
 {
-    if (!trackno)
+    while (self->dir.chainsize < sectors)
     {
-	if ((opts->flags & CFF_FILESONDIRTRACK)
-		&& (opts->flags & CFF_TALLOC_PREFDIRTRACK))
+	const DirSector *tail = self->dir.chain + self->dir.chainsize - 1;
+	uint8_t trackno = tail->track;
+	uint8_t nextsect = tail->sector;
+	if (findDirSector(self->bam, &trackno, &nextsect,
+		    &self->options) < 0)
 	{
-	    return 18;
-	}
-	if (opts->flags & CFF_TALLOC_TRACKLOAD)
-	{
-	    return 1;
-	}
-	if (opts->flags & CFF_TALLOC_SIMPLE)
-	{
-	    return 19;
+	    return -1;
 	}
-	return 17;
-    }
-    if (opts->flags & (CFF_TALLOC_TRACKLOAD | CFF_TALLOC_SIMPLE))
-    {
-	return nextTrack(opts, trackno);
+	uint8_t *dir = Sector_content(D64_sector(
+		    self->d64, tail->track, tail->sector));
+	dir[0] = trackno;
+	dir[1] = nextsect;
+	appendDirSector(self, trackno, nextsect);
     }
-    if (trackno >= 40 && !(opts->flags & CFF_42TRACK))
-    {
-	return 0;
-    }
-    if (trackno >= 35)
+    return 0;
+}
+
+static void shrinkDir(CbmdosFs *self, unsigned sectors)
+{
+    while (self->dir.chainsize > sectors)
     {
-	if (!(opts->flags & (CFF_40TRACK | CFF_42TRACK)))
-	{
-	    return 0;
-	}
-	return trackno + 1;
+	const DirSector *tail = self->dir.chain + --self->dir.chainsize;
+	bamRelease(self->bam, tail->track, tail->sector);
     }
-    int diff = 18 - trackno;
-    if (!diff) return 17;
-    if (diff > 0) return 18 + diff;
-    return 18 + diff - 1;
+    const DirSector *tail = self->dir.chain + sectors - 1;
+    uint8_t *dir = Sector_content(D64_sector(
+		self->d64, tail->track, tail->sector));
+    dir[0] = 0;
+    dir[1] = 0xff;
 }
 
-static int findStartSector(CbmdosFs *self,
-        uint8_t *trackno, uint8_t *sectno, const CbmdosFsOptions *opts)
+static void createDirEntry(CbmdosFs *self, unsigned pos, uint8_t *dirent)
 {
-    uint8_t tn = startTrack(opts, 0);
-    do
+    memset(dirent, 0, 0x20);
+    if (pos >= self->dir.size) return;
+    const CbmdosFile *file = CbmdosVfs_rfile(self->vfs, pos);
+    int invalidType = CbmdosFile_invalidType(file);
+    if (invalidType < 0) dirent[2] = CbmdosFile_type(file);
+    else dirent[2] = (uint8_t)invalidType & 0xf;
+    if (CbmdosFile_locked(file)) dirent[2] |= 1<<6;
+    if (CbmdosFile_closed(file)) dirent[2] |= 1<<7;
+    dirent[3] = self->dir.entries[pos].starttrack;
+    dirent[4] = self->dir.entries[pos].startsector;
+    memset(dirent+5, 0xa0, 0x10);
+    uint8_t namelen;
+    const char *name = CbmdosFile_name(file, &namelen);
+    memcpy(dirent+5, name, namelen);
+    if (CbmdosFile_type(file) == CFT_REL)
     {
-	for (uint8_t sn = 0;
-		sn < Track_sectors(D64_rtrack(self->d64, tn)); ++sn)
-	{
-	    if (!self->bam[tn-1][sn])
-	    {
-		*trackno = tn;
-		*sectno = sn;
-		return 0;
-	    }
-	}
-    } while ((tn = startTrack(opts, tn)));
-    return -1;
+	dirent[0x15] = self->dir.entries[pos].sidetrack;
+	dirent[0x16] = self->dir.entries[pos].sidesector;
+	dirent[0x17] = CbmdosFile_recordLength(file);
+    }
+    dirent[0x1e] = self->dir.entries[pos].blocks & 0xff;
+    dirent[0x1f] = self->dir.entries[pos].blocks >> 8;
 }
 
-static int findNextSector(CbmdosFs *self,
-        uint8_t *trackno, uint8_t *sectno, const CbmdosFsOptions *opts)
+/* writes a directory entry (or an empty slot for positions after the last
+ * file), the first two bytes of a slot belong to the sector link and are
+ * left alone. Sectors are only modified if the entry actually changed. */
+static void writeDirEntry(CbmdosFs *self, unsigned pos)
 {
-    uint8_t tn = *trackno;
-    uint8_t sn = freeSectorOnTrack(self, tn, *sectno, opts->fileInterleave,
-            (opts->flags & CFF_SIMPLEINTERLEAVE));
-    do
-    {
-	if (sn != 0xff)
-	{
-	    *trackno = tn;
-	    *sectno = sn;
-	    return 0;
-	}
-	if ((tn = nextTrack(opts, tn)))
-	{
-	    if (opts->flags & CFF_TALLOC_CHAININTERLV)
-	    {
-		sn = freeSectorOnTrack(self, tn, sn, opts->fileInterleave,
-                        (opts->flags & CFF_SIMPLEINTERLEAVE));
-	    }
-	    else
-	    {
-		sn = freeSectorOnTrack(self, tn, sn, 0, 0);
-	    }
-	}
-    } while (tn);
-    return findStartSector(self, trackno, sectno, opts);
+    uint8_t dirent[0x20];
+    createDirEntry(self, pos, dirent);
+    const DirSector *dirsect = self->dir.chain + pos / 8;
+    unsigned offset = 0x20 * (pos % 8);
+    const uint8_t *current = Sector_rcontent(D64_rsector(
+		self->d64, dirsect->track, dirsect->sector)) + offset;
+    if (!memcmp(current+2, dirent+2, 0x1e)) return;
+    uint8_t *dir = Sector_content(D64_sector(
+		self->d64, dirsect->track, dirsect->sector));
+    memcpy(dir + offset + 2, dirent+2, 0x1e);
 }
 
-static int updateDir(CbmdosFs *self)
+/* Updates the directory after the entries from position first up to
+ * (excluding) last changed. The sector chain is only extended or shrunk at
+ * its end. After reading an image or rewriting the filesystem, the whole
+ * directory is rebuilt instead. */
+static int updateDir(CbmdosFs *self, unsigned first, unsigned last)
 {
-    uint8_t trackno = 18;
-    uint8_t sectno = 1;
-    deleteChain(self, trackno, sectno);
-    uint8_t *dir = Sector_content(D64_sector(self->d64, trackno, sectno));
-    memset(dir, 0, 256);
-    dir[1] = 0xff;
-    self->bam[17][1] = 1;
-    uint8_t dirpos = 0;
-    for (unsigned i = 0; i < self->dir.size; ++i)
+    unsigned sectors = self->dir.size / 8 + !!(self->dir.size % 8);
+    if (!sectors) sectors = 1;
+    if (self->dirstale)
     {
-        if (dirpos == 8)
-        {
-            uint8_t nextsect = freeSectorOnTrack(self, trackno, sectno,
-                    self->options.dirInterleave,
-                    (self->options.flags & CFF_SIMPLEINTERLEAVE));
-            if (nextsect == 0xff)
-            {
-                if (!(self->options.flags & CFF_ALLOWLONGDIR)) goto fail;
-                while (nextsect == 0xff)
-                {
-                    uint8_t nexttrack = nextTrack(&(self->options), trackno);
-                    if (nexttrack == 18) goto fail;
-                    trackno = nexttrack;
-                    nextsect = freeSectorOnTrack(self, trackno, sectno,
-                            self->options.dirInterleave,
-                            (self->options.flags & CFF_SIMPLEINTERLEAVE));
-                }
-            }
-            sectno = nextsect;
-            dir[0] = trackno;
-            dir[1] = sectno;
-            dir = Sector_content(D64_sector(self->d64, trackno, sectno));
-	    self->bam[trackno-1][sectno] = 1;
-            memset(dir, 0, 256);
-            dir[1] = 0xff;
-            dirpos = 0;
-        }
-        const CbmdosFile *file = CbmdosVfs_rfile(self->vfs, i);
-        uint8_t *dirent = dir + 0x20*dirpos;
-	int invalidType = CbmdosFile_invalidType(file);
-	if (invalidType < 0) dirent[2] = CbmdosFile_type(file);
-	else dirent[2] = (uint8_t)invalidType & 0xf;
-        if (CbmdosFile_locked(file)) dirent[2] |= 1<<6;
-        if (CbmdosFile_closed(file)) dirent[2] |= 1<<7;
-        dirent[3] = self->dir.entries[i].starttrack;
-        dirent[4] = self->dir.entries[i].startsector;
-        memset(dirent+5, 0xa0, 0x10);
-        uint8_t namelen;
-        const char *name = CbmdosFile_name(file, &namelen);
-        memcpy(dirent+5, name, namelen);
-        if (CbmdosFile_type(file) == CFT_REL)
-        {
-            dirent[0x15] = self->dir.entries[i].sidetrack;
-            dirent[0x16] = self->dir.entries[i].sidesector;
-            dirent[0x17] = CbmdosFile_recordLength(file);
-        }
-        dirent[0x1e] = self->dir.entries[i].blocks & 0xff;
-        dirent[0x1f] = self->dir.entries[i].blocks >> 8;
-	++dirpos;
+	deleteChain(self, 18, 1);
+	self->dir.chainsize = 0;
+	appendDirSector(self, 18, 1);
+	first = 0;
+	last = self->dir.size;
+    }
+    int rc = 0;
+    if (sectors < self->dir.chainsize) shrinkDir(self, sectors);
+    else rc = extendDir(self, sectors);
+    unsigned slots = 8 * self->dir.chainsize;
+    if (last > self->dir.size) last = self->dir.size;
+    if (last > slots) last = slots;
+    for (unsigned pos = first; pos < last; ++pos)
+    {
+	writeDirEntry(self, pos);
+    }
+    for (unsigned pos = self->dir.size; pos < slots; ++pos)
+    {
+	writeDirEntry(self, pos);
+    }
+    if (rc < 0)
+    {
+	logmsg(L_ERROR, "CbmdosFs: no space left writing directory.");
+	self->dirstale = 1;
+	return -1;
     }
+    self->dirstale = 0;
     self->status &= ~CFS_DIRFULL;
     return 0;
-
-fail:
-    logmsg(L_ERROR, "CbmdosFs: no space left writing directory.");
-    return -1;
 }
 
 static void scratchFile(CbmdosFs *self, unsigned pos)
@@ -414,7 +313,39 @@ static void scratchFile(CbmdosFs *self, unsigned pos)
         deleteChain(self, self->dir.entries[pos].starttrack,
                 self->dir.entries[pos].startsector);
     }
+    uint16_t realblocks = self->dir.entries[pos].realblocks;
     memset(self->dir.entries + pos, 0, sizeof *self->dir.entries);
+    self->dir.entries[pos].realblocks = realblocks;
+}
+
+static uint16_t fileBlocks(const CbmdosFile *file)
+{
+    uint16_t blocks = CbmdosFile_realBlocks(file);
+    if (CbmdosFile_type(file) == CFT_REL)
+    {
+	uint8_t sidesects = blocks / 120 + !!(blocks % 120);
+	blocks += sidesects;
+    }
+    return blocks;
+}
+
+static void countBlocks(CbmdosFs *self, unsigned pos)
+{
+    self->usedblocks -= self->dir.entries[pos].realblocks;
+    self->dir.entries[pos].realblocks = fileBlocks(
+	    CbmdosVfs_rfile(self->vfs, pos));
+    self->usedblocks += self->dir.entries[pos].realblocks;
+}
+
+static void countAllBlocks(CbmdosFs *self)
+{
+    self->usedblocks = 0;
+    for (unsigned pos = 0; pos < self->dir.size; ++pos)
+    {
+	self->dir.entries[pos].realblocks = 0;
+	countBlocks(self, pos);
+    }
+    self->blocksstale = 0;
 }
 
 static int updateFile(CbmdosFs *self, unsigned pos)
@@ -445,17 +376,17 @@ static int updateFile(CbmdosFs *self, unsigned pos)
     CbmdosFsOptions opts = self->options;
     CbmdosFsOptions_applyOverrides(&opts, &overrides);
 
-    uint8_t tracks[720];
-    uint8_t sectors[720];
+    uint8_t tracks[720] = { 0 };
+    uint8_t sectors[720] = { 0 };
     uint16_t sidesectlinkno = 0;
 
-    if (findStartSector(self, &trackno, &sectno, &opts) < 0) goto fail;
+    if (findStartSector(self->bam, &trackno, &sectno, &opts) < 0) goto fail;
     self->dir.entries[pos].starttrack = trackno;
     self->dir.entries[pos].startsector = sectno;
     const uint8_t *content = FileData_rcontent(fdat);
     while (length)
     {
-	self->bam[trackno-1][sectno] = 1;
+	bamAllocate(self->bam, trackno, sectno);
         if (type == CFT_REL)
         {
             tracks[sidesectlinkno] = trackno;
@@ -480,7 +411,7 @@ static int updateFile(CbmdosFs *self, unsigned pos)
 	}
 	else
 	{
-	    if (findNextSector(self, &trackno, &sectno, &opts) < 0)
+	    if (findNextSector(self->bam, &trackno, &sectno, &opts) < 0)
 	    {
 		scratchFile(self, pos);
 		goto fail;
@@ -506,12 +437,12 @@ static int updateFile(CbmdosFs *self, unsigned pos)
         uint8_t sidesectors[6] = { 0 };
         uint8_t recordlen = CbmdosFile_recordLength(file);
 
-        if (findStartSector(self, &trackno, &sectno, &opts) < 0)
+        if (findStartSector(self->bam, &trackno, &sectno, &opts) < 0)
         {
             scratchFile(self, pos);
             goto fail;
         }
-        self->bam[trackno-1][sectno] = 1;
+        bamAllocate(self->bam, trackno, sectno);
         sidetracks[0] = trackno;
         sidesectors[0] = sectno;
         self->dir.entries[pos].sidetrack = trackno;
@@ -523,14 +454,14 @@ static int updateFile(CbmdosFs *self, unsigned pos)
         sidesects[0][3] = recordlen;
         for (uint8_t i = 1; i < sidesectnum; ++i)
         {
-            if (findNextSector(self, &trackno, &sectno, &opts) < 0)
+            if (findNextSector(self->bam, &trackno, &sectno, &opts) < 0)
             {
                 scratchFile(self, pos);
                 goto fail;
             }
             sidesects[i-1][0] = trackno;
             sidesects[i-1][1] = sectno;
-            self->bam[trackno-1][sectno] = 1;
+            bamAllocate(self->bam, trackno, sectno);
             sidetracks[i] = trackno;
             sidesectors[i] = sectno;
             sidesects[i] = Sector_content(D64_sector(
@@ -559,9 +490,30 @@ static int updateFile(CbmdosFs *self, unsigned pos)
 
 fail:
     logmsg(L_ERROR, "CbmdosFs: no space left writing file.");
+    self->dir.entries[pos].unplaced = 1;
     return -1;
 }
 
+/* retries the files that didn't fit, in directory order. Files already
+ * placed aren't moved, so CFS_DISKFULL ends up like after a full layout, but
+ * the blocks can be placed differently than by CbmdosFs_rewrite(), use
+ * CbmdosFs_defragment() for that. */
+static void placeUnplaced(CbmdosFs *self, unsigned skip,
+	unsigned *first, unsigned *last)
+{
+    self->status &= ~CFS_DISKFULL;
+    for (unsigned pos = 0; pos < self->dir.size; ++pos)
+    {
+	if (!self->dir.entries[pos].unplaced) continue;
+	if (pos == skip || updateFile(self, pos) < 0)
+	{
+	    self->status |= CFS_DISKFULL;
+	}
+	if (pos < *first) *first = pos;
+	if (pos >= *last) *last = pos + 1;
+    }
+}
+
 static void vfsChanged(void *receiver, int id, const void *sender,
 	const void *args)
 {
@@ -569,16 +521,26 @@ static void vfsChanged(void *receiver, int id, const void *sender,
     (void)sender;
 
     CbmdosFs *self = receiver;
-    if (self->status & CFS_BROKEN) return;
+    if (self->status & CFS_BROKEN)
+    {
+	self->blocksstale = 1;
+	return;
+    }
+    /* with CFF_LAZYLAYOUT, only keep the directory entries and their block
+     * counts in sync, all files are placed again by CbmdosFs_flush() */
+    int lazy = !!(self->options.flags & CFF_LAZYLAYOUT);
+    if (lazy) self->layoutstale = 1;
     const CbmdosVfsEventArgs *ea = args;
     switch (ea->what)
     {
 	DirEntry tmpEntry;
+	unsigned firstChanged;
+	unsigned lastChanged;
 
 	case CVE_DOSVERCHANGED:
 	case CVE_NAMECHANGED:
 	case CVE_IDCHANGED:
-	    updateBam(self);
+	    if (!lazy) updateBamHeader(self);
 	    break;
 
 	case CVE_FILEADDED:
@@ -605,18 +567,21 @@ static void vfsChanged(void *receiver, int id, const void *sender,
 	    ++self->dir.size;
             memset(self->dir.entries + ea->filepos, 0,
                     sizeof *self->dir.entries);
-	    if (updateDir(self) < 0)
+	    countBlocks(self, ea->filepos);
+	    if (lazy) break;
+	    if (updateDir(self, ea->filepos, self->dir.size) < 0)
 	    {
 		self->status |= CFS_DIRFULL;
-		updateBam(self);
+		self->dir.entries[ea->filepos].unplaced = 1;
+		flushBam(self);
 		break;
 	    }
 	    if (updateFile(self, ea->filepos) < 0)
 	    {
 		self->status |= CFS_DISKFULL;
 	    }
-	    updateDir(self);
-	    updateBam(self);
+	    updateDir(self, ea->filepos, ea->filepos + 1);
+	    flushBam(self);
 	    break;
 
 	case CVE_FILEDELETED:
@@ -627,7 +592,8 @@ static void vfsChanged(void *receiver, int id, const void *sender,
 		self->status |= CFS_BROKEN;
 		break;
 	    }
-	    scratchFile(self, ea->filepos);
+	    self->usedblocks -= self->dir.entries[ea->filepos].realblocks;
+	    if (!lazy) scratchFile(self, ea->filepos);
 	    --self->dir.size;
 	    if (ea->filepos < self->dir.size)
 	    {
@@ -636,19 +602,16 @@ static void vfsChanged(void *receiver, int id, const void *sender,
 			(self->dir.size - ea->filepos)
 			* sizeof *self->dir.entries);
 	    }
+	    if (lazy) break;
+	    firstChanged = ea->filepos;
+	    lastChanged = self->dir.size;
 	    if (self->status & CFS_DISKFULL)
 	    {
-		self->status &= ~CFS_DISKFULL;
-		for (unsigned pos = 0; pos < self->dir.size; ++pos)
-		{
-		    if (updateFile(self, pos) < 0)
-		    {
-			self->status |= CFS_DISKFULL;
-		    }
-		}
+		placeUnplaced(self, self->dir.size,
+			&firstChanged, &lastChanged);
 	    }
-	    updateDir(self);
-	    updateBam(self);
+	    updateDir(self, firstChanged, self->dir.size);
+	    flushBam(self);
 	    break;
 
 	case CVE_FILEMOVED:
@@ -678,11 +641,23 @@ static void vfsChanged(void *receiver, int id, const void *sender,
 	    }
 	    memcpy(self->dir.entries + ea->targetpos, &tmpEntry,
 		    sizeof *self->dir.entries);
-	    updateDir(self);
-	    updateBam(self);
+	    if (lazy) break;
+	    if (ea->targetpos > ea->filepos)
+	    {
+		updateDir(self, ea->filepos, ea->targetpos + 1);
+	    }
+	    else
+	    {
+		updateDir(self, ea->targetpos, ea->filepos + 1);
+	    }
+	    flushBam(self);
 	    break;
 
 	case CVE_FILECHANGED:
+	    firstChanged = ea->filepos;
+	    lastChanged = ea->filepos + 1;
+	    countBlocks(self, ea->filepos);
+	    if (lazy) break;
 	    if (ea->fileEventArgs->what == CFE_DATACHANGED
                     || ea->fileEventArgs->what == CFE_TYPECHANGED
                     || ea->fileEventArgs->what == CFE_RECORDLENGTHCHANGED
@@ -695,18 +670,124 @@ static void vfsChanged(void *receiver, int id, const void *sender,
 		}
 		if (self->status & CFS_DISKFULL)
 		{
-		    self->status &= ~CFS_DISKFULL;
-		    for (unsigned pos = 0; pos < self->dir.size; ++pos)
-		    {
-			if (updateFile(self, pos) < 0)
-			{
-			    self->status |= CFS_DISKFULL;
-			}
-		    }
+		    placeUnplaced(self, ea->filepos,
+			    &firstChanged, &lastChanged);
 		}
 	    }
-	    updateDir(self);
-	    updateBam(self);
+	    updateDir(self, firstChanged, lastChanged);
+	    flushBam(self);
+	    break;
+
+	case CVE_FILESADDED:
+	    if (ea->filepos != self->dir.size)
+	    {
+		logmsg(L_ERROR, "CbmdosFs: inconsistent state, files added at "
+			"invalid position.");
+		self->status |= CFS_BROKEN;
+		break;
+	    }
+	    while (self->dir.size + ea->count > self->dir.capa)
+	    {
+		self->dir.capa += DIRCHUNK;
+		self->dir.entries = xrealloc(self->dir.entries,
+			self->dir.capa * sizeof *self->dir.entries);
+	    }
+	    memset(self->dir.entries + self->dir.size, 0,
+		    ea->count * sizeof *self->dir.entries);
+	    self->dir.size += ea->count;
+	    for (unsigned pos = ea->filepos; pos < self->dir.size; ++pos)
+	    {
+		countBlocks(self, pos);
+	    }
+	    if (lazy) break;
+	    if (updateDir(self, ea->filepos, self->dir.size) < 0)
+	    {
+		self->status |= CFS_DIRFULL;
+		for (unsigned pos = ea->filepos; pos < self->dir.size; ++pos)
+		{
+		    self->dir.entries[pos].unplaced = 1;
+		}
+		flushBam(self);
+		break;
+	    }
+	    for (unsigned pos = ea->filepos; pos < self->dir.size; ++pos)
+	    {
+		if (updateFile(self, pos) < 0)
+		{
+		    self->status |= CFS_DISKFULL;
+		}
+	    }
+	    updateDir(self, ea->filepos, self->dir.size);
+	    flushBam(self);
+	    break;
+
+	case CVE_FILESDELETED:
+	    if (ea->count > self->dir.size
+		    || ea->positions[ea->count - 1] >= self->dir.size)
+	    {
+		logmsg(L_ERROR, "CbmdosFs: inconsistent state, non-existent "
+			"files removed.");
+		self->status |= CFS_BROKEN;
+		break;
+	    }
+	    firstChanged = ea->positions[0];
+	    lastChanged = firstChanged;
+	    for (unsigned pos = firstChanged, next = 0;
+		    pos < self->dir.size; ++pos)
+	    {
+		if (next < ea->count && pos == ea->positions[next])
+		{
+		    self->usedblocks -= self->dir.entries[pos].realblocks;
+		    if (!lazy) scratchFile(self, pos);
+		    ++next;
+		}
+		else
+		{
+		    self->dir.entries[lastChanged++] = self->dir.entries[pos];
+		}
+	    }
+	    self->dir.size = lastChanged;
+	    if (lazy) break;
+	    if (self->status & CFS_DISKFULL)
+	    {
+		placeUnplaced(self, self->dir.size,
+			&firstChanged, &lastChanged);
+	    }
+	    updateDir(self, firstChanged, self->dir.size);
+	    flushBam(self);
+	    break;
+
+	case CVE_FILESREORDERED:
+	    if (ea->count != self->dir.size)
+	    {
+		logmsg(L_ERROR, "CbmdosFs: inconsistent state, files "
+			"reordered with wrong number of files.");
+		self->status |= CFS_BROKEN;
+		break;
+	    }
+	    firstChanged = self->dir.size;
+	    lastChanged = 0;
+	    for (unsigned pos = 0; pos < self->dir.size; ++pos)
+	    {
+		if (ea->positions[pos] != pos)
+		{
+		    if (pos < firstChanged) firstChanged = pos;
+		    lastChanged = pos + 1;
+		}
+	    }
+	    if (firstChanged < lastChanged)
+	    {
+		DirEntry *entries = xmalloc(
+			self->dir.capa * sizeof *self->dir.entries);
+		for (unsigned pos = 0; pos < self->dir.size; ++pos)
+		{
+		    entries[pos] = self->dir.entries[ea->positions[pos]];
+		}
+		free(self->dir.entries);
+		self->dir.entries = entries;
+		if (!lazy) updateDir(self, firstChanged, lastChanged);
+	    }
+	    if (!lazy) flushBam(self);
 	    break;
     }
 }
@@ -737,15 +818,19 @@ static int validateOptions(CbmdosFsOptions options)
     return 0;
 }
 
+static D64Type imageType(const CbmdosFsOptions *options)
+{
+    if (options->flags & CFF_42TRACK) return D64_42TRACK;
+    if (options->flags & CFF_40TRACK) return D64_40TRACK;
+    return D64_STANDARD;
+}
+
 SOEXPORT CbmdosFs *CbmdosFs_create(CbmdosFsOptions options)
 {
     if (validateOptions(options) < 0) return 0;
     CbmdosFs *self = xmalloc(sizeof *self);
     memset(self, 0, sizeof *self);
-    D64Type d64Type = D64_STANDARD;
-    if (options.flags & CFF_42TRACK) d64Type = D64_42TRACK;
-    else if (options.flags & CFF_40TRACK) d64Type = D64_40TRACK;
-    self->d64 = D64_create(d64Type);
+    self->d64 = D64_create(imageType(&options));
     self->dir.capa = DIRCHUNK;
     self->dir.entries = xmalloc(DIRCHUNK * sizeof *self->dir.entries);
     self->vfs = CbmdosVfs_create();
@@ -754,8 +839,9 @@ SOEXPORT CbmdosFs *CbmdosFs_create(CbmdosFsOptions options)
 	CbmdosVfs_setDosver(self->vfs, 0x50);
     }
     self->options = options;
-    self->bam[17][0] = 1;
-    updateDir(self);
+    bamAllocate(self->bam, 18, 0);
+    self->dirstale = 1;
+    updateDir(self, 0, 0);
     updateBam(self);
     Event_register(CbmdosVfs_changedEvent(self->vfs), self, vfsChanged);
     return self;
@@ -764,6 +850,11 @@ SOEXPORT CbmdosFs *CbmdosFs_create(CbmdosFsOptions options)
 SOEXPORT CbmdosFs *CbmdosFs_fromImage(D64 *d64, CbmdosFsOptions options)
 {
     if (validateOptions(options) < 0) return 0;
+    if (D64_readOnly(d64))
+    {
+	logmsg(L_ERROR, "CbmdosFs_fromImage: the image is read-only.");
+	return 0;
+    }
     switch (D64_type(d64))
     {
 	case D64_STANDARD:
@@ -809,6 +900,8 @@ SOEXPORT CbmdosFs *CbmdosFs_fromImage(D64 *d64, CbmdosFsOptions options)
     self->dir.entries = xmalloc(DIRCHUNK * sizeof *self->dir.entries);
     self->vfs = CbmdosVfs_create();
     self->options = options;
+    self->bamstale = 1;
+    self->dirstale = 1;
     int rc = readCbmdosVfsInternal(self->vfs, self->d64,
 	    &self->options, self->bam, &self->dir);
     switch (rc)
@@ -821,6 +914,7 @@ SOEXPORT CbmdosFs *CbmdosFs_fromImage(D64 *d64, CbmdosFsOptions options)
 	    self->status |= CFS_INVALIDBAM;
 	    break;
     }
+    countAllBlocks(self);
     if (self->options.flags & CFF_RECOVER)
     {
 	self->options.flags &= ~CFF_RECOVER;
@@ -859,8 +953,40 @@ SOEXPORT CbmdosFs *CbmdosFs_fromVfs(CbmdosVfs *vfs, CbmdosFsOptions options)
     return self;
 }
 
+SOLOCAL void CbmdosFs_allocation(const CbmdosFs *self, uint32_t *bam,
+	DirSector *dirtail, unsigned *dirsectors, unsigned *files)
+{
+    memcpy(bam, self->bam, sizeof self->bam);
+    if (self->dirstale || !self->dir.chainsize)
+    {
+	releaseChain(self->d64, bam, 18, 1);
+	bamAllocate(bam, 18, 1);
+	dirtail->track = 18;
+	dirtail->sector = 1;
+	*dirsectors = 1;
+    }
+    else
+    {
+	*dirtail = self->dir.chain[self->dir.chainsize - 1];
+	*dirsectors = self->dir.chainsize;
+    }
+    *files = self->dir.size;
+}
+
+SOLOCAL int CbmdosFs_fileStart(const CbmdosFs *self, unsigned pos,
+	uint8_t *track, uint8_t *sector)
+{
+    if (self->layoutstale || pos >= self->dir.size) return -1;
+    const DirEntry *entry = self->dir.entries + pos;
+    if (entry->unplaced || !entry->starttrack) return -1;
+    *track = entry->starttrack;
+    *sector = entry->startsector;
+    return 0;
+}
+
 SOEXPORT CbmdosFsStatus CbmdosFs_status(const CbmdosFs *self)
 {
+    if (self->layoutstale) return CFS_LAYOUTPENDING;
     return self->status;
 }
 
@@ -890,9 +1016,10 @@ SOEXPORT int CbmdosFs_setOptions(CbmdosFs *self, CbmdosFsOptions options)
     if (needRewrite < 0) return -1;
     CbmdosFsFlags changedFlags = self->options.flags ^ options.flags;
     self->options = options;
-    if (needRewrite)
+    if (needRewrite || self->layoutstale)
     {
-        CbmdosFs_rewrite(self);
+	if (options.flags & CFF_LAZYLAYOUT) self->layoutstale = 1;
+	else CbmdosFs_rewrite(self);
         return 1;
     }
     else if (changedFlags & (CFF_SPEEDDOSBAM|CFF_DOLPHINDOSBAM
@@ -912,7 +1039,8 @@ SOEXPORT int CbmdosFs_optionsWillRewrite(
     if (changedFlags & (
 		CFF_FILESONDIRTRACK|CFF_ALLOWLONGDIR|CFF_42TRACK|
 		CFF_SIMPLEINTERLEAVE|CFF_TALLOC_TRACKLOAD|CFF_TALLOC_SIMPLE|
-		CFF_TALLOC_PREFDIRTRACK|CFF_TALLOC_CHAININTERLV))
+		CFF_TALLOC_PREFDIRTRACK|CFF_TALLOC_CHAININTERLV|
+		CFF_TALLOC_LOADTIME))
     {
 	return 1;
     }
@@ -922,21 +1050,33 @@ SOEXPORT int CbmdosFs_optionsWillRewrite(
     }
     if (options.dirInterleave != self->options.dirInterleave) return 1;
     if (options.fileInterleave != self->options.fileInterleave) return 1;
+    if ((options.flags & CFF_TALLOC_LOADTIME)
+	    && (options.blockTime != self->options.blockTime
+		|| options.stepTime != self->options.stepTime))
+    {
+	return 1;
+    }
     return 0;
 }
 
-SOEXPORT int CbmdosFs_rewrite(CbmdosFs *self)
+static int layoutFiles(CbmdosFs *self)
 {
-    D64_destroy(self->d64);
-    D64Type d64Type = D64_STANDARD;
-    if (self->options.flags & CFF_42TRACK) d64Type = D64_42TRACK;
-    else if (self->options.flags & CFF_40TRACK) d64Type = D64_40TRACK;
-    self->d64 = D64_create(d64Type);
+    self->layoutstale = 0;
+    self->dir.size = CbmdosVfs_fileCount(self->vfs);
+    if (self->dir.size > self->dir.capa)
+    {
+	while (self->dir.capa < self->dir.size) self->dir.capa += DIRCHUNK;
+	self->dir.entries = xrealloc(self->dir.entries,
+		self->dir.capa * sizeof *self->dir.entries);
+    }
     self->status = CFS_OK;
+    self->bamstale = 1;
+    self->dirstale = 1;
     memset(self->dir.entries, 0, self->dir.size * sizeof *self->dir.entries);
+    countAllBlocks(self);
     memset(self->bam, 0, sizeof self->bam);
-    self->bam[17][0] = 1;
-    if (updateDir(self) < 0)
+    bamAllocate(self->bam, 18, 0);
+    if (updateDir(self, 0, self->dir.size) < 0)
     {
 	self->status |= CFS_DIRFULL;
 	return -1;
@@ -946,12 +1086,134 @@ SOEXPORT int CbmdosFs_rewrite(CbmdosFs *self)
 	if (updateFile(self, pos) < 0)
 	{
 	    self->status |= CFS_DISKFULL;
-	    return -1;
 	}
     }
-    updateDir(self);
+    updateDir(self, 0, self->dir.size);
     updateBam(self);
-    return 0;
+    return (self->status & CFS_DISKFULL) ? -1 : 0;
+}
+
+SOEXPORT int CbmdosFs_rewrite(CbmdosFs *self)
+{
+    D64Type type = imageType(&self->options);
+    D64 *d64 = self->d64 ? D64_reset(self->d64, type) : 0;
+    if (!d64)
+    {
+	D64_destroy(self->d64);
+	d64 = D64_create(type);
+    }
+    self->d64 = d64;
+    return layoutFiles(self);
+}
+
+SOEXPORT int CbmdosFs_flush(CbmdosFs *self)
+{
+    if (self->layoutstale) return CbmdosFs_rewrite(self);
+    return (self->status & (CFS_DIRFULL|CFS_DISKFULL)) ? -1 : 0;
+}
+
+/* collects the blocks of all files, data blocks followed by side sectors.
+ * start[pos] is the index of the first block of file pos, start[size] the
+ * number of blocks collected. */
+static unsigned collectBlocks(const CbmdosFs *self, DirSector *blocks,
+	unsigned *start)
+{
+    unsigned count = 0;
+    for (unsigned pos = 0; pos < self->dir.size; ++pos)
+    {
+	start[pos] = count;
+	const DirEntry *entry = self->dir.entries + pos;
+	if (entry->unplaced) continue;
+	uint8_t chains[2][2] = {
+	    { entry->starttrack, entry->startsector },
+	    { entry->sidetrack, entry->sidesector }
+	};
+	for (int c = 0; c < 2; ++c)
+	{
+	    uint8_t trackno = chains[c][0];
+	    uint8_t sectno = chains[c][1];
+	    while (trackno && count < MAXBLOCKS)
+	    {
+		const Track *track = D64_rtrack(self->d64, trackno);
+		if (!track || sectno >= Track_sectors(track)) break;
+		blocks[count].track = trackno;
+		blocks[count].sector = sectno;
+		++count;
+		const uint8_t *content = Sector_rcontent(
+			Track_rsector(track, sectno));
+		trackno = content[0];
+		sectno = content[1];
+	    }
+	}
+    }
+    start[self->dir.size] = count;
+    return count;
+}
+
+SOEXPORT int CbmdosFs_defragment(CbmdosFs *self, CbmdosFsOptions options)
+{
+    if (validateOptions(options) < 0) return -1;
+    if (D64_readOnly(self->d64))
+    {
+	logmsg(L_ERROR, "CbmdosFs_defragment: image is read-only.");
+	return -1;
+    }
+    CbmdosFs_flush(self);
+
+    /* check the files fit before clearing the image */
+    CbmdosFsPlan *plan = CbmdosFsPlan_create(options);
+    CbmdosFsPlan_addVfs(plan, self->vfs);
+    int failed = CbmdosFsPlan_firstFailed(plan);
+    CbmdosFsPlan_destroy(plan);
+    if (failed >= 0)
+    {
+	logmsg(L_ERROR, "CbmdosFs_defragment: files don't fit on the disk "
+		"with the given options.");
+	return -1;
+    }
+
+    unsigned size = self->dir.size;
+    DirSector *oldblocks = xmalloc(MAXBLOCKS * sizeof *oldblocks);
+    unsigned *oldstart = xmalloc((size + 1) * sizeof *oldstart);
+    if (self->status & CFS_BROKEN) oldstart[size] = 0;
+    else collectBlocks(self, oldblocks, oldstart);
+
+    self->options = options;
+    self->d64 = D64_reset(self->d64, imageType(&options));
+    int rc = layoutFiles(self);
+
+    DirSector *blocks = xmalloc(MAXBLOCKS * sizeof *blocks);
+    unsigned *start = xmalloc((self->dir.size + 1) * sizeof *start);
+    collectBlocks(self, blocks, start);
+    int moved = 0;
+    for (unsigned pos = 0; pos < self->dir.size; ++pos)
+    {
+	unsigned oldlen = 0;
+	if (pos < size && oldstart[size])
+	{
+	    oldlen = oldstart[pos+1] - oldstart[pos];
+	}
+	for (unsigned i = start[pos]; i < start[pos+1]; ++i)
+	{
+	    unsigned n = i - start[pos];
+	    if (n >= oldlen)
+	    {
+		++moved;
+		continue;
+	    }
+	    const DirSector *old = oldblocks + oldstart[pos] + n;
+	    if (old->track != blocks[i].track
+		    || old->sector != blocks[i].sector)
+	    {
+		++moved;
+	    }
+	}
+    }
+    free(start);
+    free(blocks);
+    free(oldstart);
+    free(oldblocks);
+    return rc < 0 ? -1 : moved;
 }
 
 SOEXPORT uint16_t CbmdosFs_freeBlocks(const CbmdosFs *self)
@@ -981,19 +1243,17 @@ SOEXPORT uint16_t CbmdosFs_freeBlocks(const CbmdosFs *self)
 	unsigned freedirblocks = freefiles / 8;
 	free += freedirblocks;
     }
-    for (unsigned n = 0; n < filecount; ++n)
+    unsigned long used = self->usedblocks;
+    if (self->blocksstale)
     {
-	const CbmdosFile *file = CbmdosVfs_rfile(self->vfs, n);
-	uint16_t fileBlocks = CbmdosFile_realBlocks(file);
-        if (CbmdosFile_type(file) == CFT_REL)
-        {
-            uint8_t sidesects = fileBlocks / 120 + !!(fileBlocks % 120);
-            fileBlocks += sidesects;
-        }
-	if (fileBlocks > free) return 0xffff;
-	free -= fileBlocks;
+	used = 0;
+	for (unsigned n = 0; n < filecount; ++n)
+	{
+	    used += fileBlocks(CbmdosVfs_rfile(self->vfs, n));
+	}
     }
-    return free;
+    if (used > free) return 0xffff;
+    return free - used;
 }
 
 SOEXPORT void CbmdosFs_getFreeBlocksLine(const CbmdosFs *self, uint8_t *line)
@@ -1016,6 +1276,7 @@ SOEXPORT void CbmdosFs_destroy(CbmdosFs *self)
 {
     if (!self) return;
     free(self->dir.entries);
+    free(self->dir.chain);
     CbmdosVfs_destroy(self->vfs);
     D64_destroy(self->d64);
     free(self);
@@ -0,0 +1,13 @@
+#ifndef CBMDOSFS_H
+#define CBMDOSFS_H
+
+#include <1541img/cbmdosfs.h>
+
+typedef struct DirSector DirSector;
+
+void CbmdosFs_allocation(const CbmdosFs *self, uint32_t *bam,
+	DirSector *dirtail, unsigned *dirsectors, unsigned *files);
+int CbmdosFs_fileStart(const CbmdosFs *self, unsigned pos,
+	uint8_t *track, uint8_t *sector);
+
+#endif
@@ -0,0 +1,265 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "bamdata.h"
+#include "blockalloc.h"
+#include "dirdata.h"
+#include "cbmdosfs.h"
+#include <1541img/cbmdosfile.h>
+#include <1541img/cbmdosvfs.h>
+#include <1541img/filedata.h>
+
+#include <1541img/cbmdosfsplan.h>
+
+#define PLANCHUNK 144
+#define BLOCKCHUNK 1024
+
+typedef struct PlannedFile
+{
+    size_t chain;
+    unsigned length;
+    unsigned sidesects;
+    int fits;
+} PlannedFile;
+
+struct CbmdosFsPlan
+{
+    PlannedFile *files;
+    CbmdosBlockPos *blocks;
+    size_t blockCount;
+    size_t blockCapa;
+    unsigned fileCount;
+    unsigned fileCapa;
+    unsigned dirFiles;
+    unsigned dirSectors;
+    int dirFull;
+    unsigned usedBlocks;
+    CbmdosFsOptions options;
+    DirSector dirTail;
+    uint32_t bam[42];
+};
+
+static CbmdosFsPlan *createPlan(CbmdosFsOptions options)
+{
+    CbmdosFsPlan *self = xmalloc(sizeof *self);
+    memset(self, 0, sizeof *self);
+    self->files = xmalloc(PLANCHUNK * sizeof *self->files);
+    self->fileCapa = PLANCHUNK;
+    self->blocks = xmalloc(BLOCKCHUNK * sizeof *self->blocks);
+    self->blockCapa = BLOCKCHUNK;
+    self->options = options;
+    return self;
+}
+
+SOEXPORT CbmdosFsPlan *CbmdosFsPlan_create(CbmdosFsOptions options)
+{
+    CbmdosFsPlan *self = createPlan(options);
+    bamAllocate(self->bam, 18, 0);
+    bamAllocate(self->bam, 18, 1);
+    self->dirTail.track = 18;
+    self->dirTail.sector = 1;
+    self->dirSectors = 1;
+    return self;
+}
+
+SOEXPORT CbmdosFsPlan *CbmdosFsPlan_fromFs(const CbmdosFs *fs)
+{
+    CbmdosFsPlan *self = createPlan(CbmdosFs_options(fs));
+    CbmdosFs_allocation(fs, self->bam, &self->dirTail,
+	    &self->dirSectors, &self->dirFiles);
+    return self;
+}
+
+static int extendDir(CbmdosFsPlan *self)
+{
+    unsigned sectors = self->dirFiles / 8 + !!(self->dirFiles % 8);
+    while (self->dirSectors < sectors)
+    {
+	uint8_t trackno = self->dirTail.track;
+	uint8_t sectno = self->dirTail.sector;
+	if (findDirSector(self->bam, &trackno, &sectno, &self->options) < 0)
+	{
+	    self->dirFull = 1;
+	    return -1;
+	}
+	bamAllocate(self->bam, trackno, sectno);
+	self->dirTail.track = trackno;
+	self->dirTail.sector = sectno;
+	++self->dirSectors;
+    }
+    return 0;
+}
+
+static PlannedFile *appendFile(CbmdosFsPlan *self)
+{
+    if (self->fileCount == self->fileCapa)
+    {
+	self->fileCapa += PLANCHUNK;
+	self->files = xrealloc(self->files,
+		self->fileCapa * sizeof *self->files);
+    }
+    PlannedFile *file = self->files + self->fileCount++;
+    memset(file, 0, sizeof *file);
+    file->chain = self->blockCount;
+    return file;
+}
+
+static void appendBlock(CbmdosFsPlan *self, uint8_t trackno, uint8_t sectno)
+{
+    if (self->blockCount == self->blockCapa)
+    {
+	self->blockCapa += BLOCKCHUNK;
+	self->blocks = xrealloc(self->blocks,
+		self->blockCapa * sizeof *self->blocks);
+    }
+    bamAllocate(self->bam, trackno, sectno);
+    self->blocks[self->blockCount].track = trackno;
+    self->blocks[self->blockCount].sector = sectno;
+    ++self->blockCount;
+}
+
+static int placeFile(CbmdosFsPlan *self, PlannedFile *planned,
+	const CbmdosFile *file)
+{
+    uint8_t trackno;
+    uint8_t sectno;
+
+    size_t length = FileData_size(CbmdosFile_rdata(file));
+    int invalidType = CbmdosFile_invalidType(file);
+    CbmdosFileType type = CbmdosFile_type(file);
+    if ((invalidType < 0 && type == CFT_DEL) || !length) return 0;
+
+    CbmdosFsOptOverrides overrides = CbmdosFile_optOverrides(file);
+    CbmdosFsOptions opts = self->options;
+    CbmdosFsOptions_applyOverrides(&opts, &overrides);
+
+    size_t blocks = length / 254 + !!(length % 254);
+    if (type == CFT_REL && blocks > 720) return -1;
+    if (findStartSector(self->bam, &trackno, &sectno, &opts) < 0) goto fail;
+    for (size_t i = 0; i < blocks; ++i)
+    {
+	appendBlock(self, trackno, sectno);
+	++planned->length;
+	if (i + 1 < blocks
+		&& findNextSector(self->bam, &trackno, &sectno, &opts) < 0)
+	{
+	    goto fail;
+	}
+    }
+
+    if (type == CFT_REL)
+    {
+	unsigned sidesectnum = blocks / 120 + !!(blocks % 120);
+	if (findStartSector(self->bam, &trackno, &sectno, &opts) < 0)
+	{
+	    goto fail;
+	}
+	appendBlock(self, trackno, sectno);
+	++planned->sidesects;
+	for (unsigned i = 1; i < sidesectnum; ++i)
+	{
+	    if (findNextSector(self->bam, &trackno, &sectno, &opts) < 0)
+	    {
+		goto fail;
+	    }
+	    appendBlock(self, trackno, sectno);
+	    ++planned->sidesects;
+	}
+    }
+    return 0;
+
+fail:
+    while (self->blockCount > planned->chain)
+    {
+	--self->blockCount;
+	bamRelease(self->bam, self->blocks[self->blockCount].track,
+		self->blocks[self->blockCount].sector);
+    }
+    planned->length = 0;
+    planned->sidesects = 0;
+    return -1;
+}
+
+static int planFile(CbmdosFsPlan *self, PlannedFile *planned,
+	const CbmdosFile *file)
+{
+    if (self->dirFull || placeFile(self, planned, file) < 0) return -1;
+    planned->fits = 1;
+    self->usedBlocks += planned->length + planned->sidesects;
+    return 0;
+}
+
+SOEXPORT int CbmdosFsPlan_addFile(
+	CbmdosFsPlan *self, const CbmdosFile *file)
+{
+    PlannedFile *planned = appendFile(self);
+    ++self->dirFiles;
+    if (!self->dirFull) extendDir(self);
+    return planFile(self, planned, file);
+}
+
+SOEXPORT int CbmdosFsPlan_addVfs(CbmdosFsPlan *self, const CbmdosVfs *vfs)
+{
+    unsigned count = CbmdosVfs_fileCount(vfs);
+    self->dirFiles += count;
+    if (!self->dirFull) extendDir(self);
+    int rc = 0;
+    for (unsigned pos = 0; pos < count; ++pos)
+    {
+	PlannedFile *planned = appendFile(self);
+	if (planFile(self, planned, CbmdosVfs_rfile(vfs, pos)) < 0) rc = -1;
+    }
+    return rc;
+}
+
+SOEXPORT unsigned CbmdosFsPlan_fileCount(const CbmdosFsPlan *self)
+{
+    return self->fileCount;
+}
+
+SOEXPORT int CbmdosFsPlan_fits(const CbmdosFsPlan *self, unsigned pos)
+{
+    if (pos >= self->fileCount) return 0;
+    return self->files[pos].fits;
+}
+
+SOEXPORT int CbmdosFsPlan_firstFailed(const CbmdosFsPlan *self)
+{
+    for (unsigned pos = 0; pos < self->fileCount; ++pos)
+    {
+	if (!self->files[pos].fits) return (int)pos;
+    }
+    return -1;
+}
+
+SOEXPORT const CbmdosBlockPos *CbmdosFsPlan_chain(
+	const CbmdosFsPlan *self, unsigned pos, unsigned *length)
+{
+    *length = 0;
+    if (pos >= self->fileCount || !self->files[pos].length) return 0;
+    *length = self->files[pos].length;
+    return self->blocks + self->files[pos].chain;
+}
+
+SOEXPORT const CbmdosBlockPos *CbmdosFsPlan_sideSectors(
+	const CbmdosFsPlan *self, unsigned pos, unsigned *length)
+{
+    *length = 0;
+    if (pos >= self->fileCount || !self->files[pos].sidesects) return 0;
+    *length = self->files[pos].sidesects;
+    return self->blocks + self->files[pos].chain + self->files[pos].length;
+}
+
+SOEXPORT unsigned CbmdosFsPlan_blocks(const CbmdosFsPlan *self)
+{
+    return self->usedBlocks;
+}
+
+SOEXPORT void CbmdosFsPlan_destroy(CbmdosFsPlan *self)
+{
+    if (!self) return;
+    free(self->blocks);
+    free(self->files);
+    free(self);
+}
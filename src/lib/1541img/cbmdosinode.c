@@ -1,15 +1,28 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "util.h"
 #include "log.h"
 #include <1541img/event.h>
 #include <1541img/filedata.h>
+#include <1541img/d64.h>
+#include <1541img/sector.h>
 
-#include <1541img/cbmdosinode.h>
+#include "cbmdosinode.h"
+
+struct CbmdosInodeSource
+{
+    D64 *d64;
+    unsigned int refcount;
+};
 
 struct CbmdosInode
 {
     FileData *data;
+    CbmdosInodeSource *source;
+    size_t size;
+    uint8_t track;
+    uint8_t sector;
     Event *changedEvent;
     CbmdosFsOptOverrides overrides;
     unsigned int refcount;
@@ -27,10 +40,70 @@ static void fileDataHandler(void *receiver, int id, const void *sender,
     Event_raise(self->changedEvent, &ea);
 }
 
+SOLOCAL CbmdosInodeSource *CbmdosInodeSource_create(D64 *d64)
+{
+    CbmdosInodeSource *self = xmalloc(sizeof *self);
+    self->d64 = D64_snapshot(d64);
+    self->refcount = 1;
+    return self;
+}
+
+SOLOCAL void CbmdosInodeSource_release(CbmdosInodeSource *self)
+{
+    if (!self || --self->refcount) return;
+    D64_destroy(self->d64);
+    free(self);
+}
+
+/* reads content still referenced on the source image, the chain was
+ * already checked when reading the directory */
+static void materialize(const CbmdosInode *inode)
+{
+    if (!inode->source) return;
+
+    /* an inode is never created const, reading the content from const
+     * accessors is documented with CbmdosInode_rdata() */
+    CbmdosInode *self = (CbmdosInode *)inode;
+    uint8_t *content = xmalloc(self->size);
+    uint8_t track = self->track;
+    uint8_t sector = self->sector;
+    size_t pos = 0;
+    while (pos < self->size)
+    {
+	const uint8_t *sectorbytes = Sector_rcontent(
+		D64_rsector(self->source->d64, track, sector));
+	size_t chunk = self->size - pos;
+	if (chunk > 254) chunk = 254;
+	memcpy(content + pos, sectorbytes + 2, chunk);
+	pos += chunk;
+	track = sectorbytes[0];
+	sector = sectorbytes[1];
+    }
+    CbmdosInodeSource_release(self->source);
+    self->source = 0;
+    self->data = FileData_adopt(content, self->size, free);
+    Event_register(FileData_changedEvent(self->data), self, fileDataHandler);
+}
+
+SOLOCAL void CbmdosInode_setChain(CbmdosInode *self,
+	CbmdosInodeSource *source, uint8_t track, uint8_t sector, size_t size)
+{
+    if (!size) return;
+    Event_unregister(FileData_changedEvent(self->data), self, fileDataHandler);
+    FileData_destroy(self->data);
+    self->data = 0;
+    ++source->refcount;
+    self->source = source;
+    self->track = track;
+    self->sector = sector;
+    self->size = size;
+}
+
 SOLOCAL CbmdosInode *CbmdosInode_create(void)
 {
     CbmdosInode *self = xmalloc(sizeof *self);
     self->data = FileData_create();
+    self->source = 0;
     self->changedEvent = Event_create(0, self);
     self->overrides = CFOO_NONE;
     self->refcount = 0;
@@ -41,28 +114,49 @@ SOLOCAL CbmdosInode *CbmdosInode_create(void)
 SOLOCAL CbmdosInode *CbmdosInode_clone(const CbmdosInode *other)
 {
     CbmdosInode *self = xmalloc(sizeof *self);
-    self->data = FileData_clone(other->data);
     self->changedEvent = Event_create(0, self);
     self->overrides = other->overrides;
     self->refcount = 0;
+    self->source = other->source;
+    if (self->source)
+    {
+	++self->source->refcount;
+	self->data = 0;
+	self->track = other->track;
+	self->sector = other->sector;
+	self->size = other->size;
+	return self;
+    }
+    self->data = FileData_clone(other->data);
     Event_register(FileData_changedEvent(self->data), self, fileDataHandler);
     return self;
 }
 
 SOEXPORT const FileData *CbmdosInode_rdata(const CbmdosInode *self)
 {
+    materialize(self);
     return self->data;
 }
 
 SOEXPORT FileData *CbmdosInode_data(CbmdosInode *self)
 {
+    materialize(self);
     return self->data;
 }
 
 SOEXPORT void CbmdosInode_setData(CbmdosInode *self, FileData *data)
 {
-    Event_unregister(FileData_changedEvent(self->data), self, fileDataHandler);
-    FileData_destroy(self->data);
+    if (self->source)
+    {
+	CbmdosInodeSource_release(self->source);
+	self->source = 0;
+    }
+    else
+    {
+	Event_unregister(FileData_changedEvent(self->data),
+		self, fileDataHandler);
+	FileData_destroy(self->data);
+    }
     self->data = data;
     Event_register(FileData_changedEvent(self->data), self, fileDataHandler);
     CbmdosInodeEventArgs ea = { CIE_DATACHANGED };
@@ -71,11 +165,16 @@ SOEXPORT void CbmdosInode_setData(CbmdosInode *self, FileData *data)
 
 SOEXPORT uint16_t CbmdosInode_blocks(const CbmdosInode *self)
 {
-    if (!self->data)
+    size_t size;
+    if (self->source)
+    {
+	size = self->size;
+    }
+    else if (!self->data)
     {
 	return 0;
     }
-    size_t size = FileData_size(self->data);
+    else size = FileData_size(self->data);
     uint16_t blocks = size / 254;
     if (size % 254) ++blocks;
     return blocks;
@@ -125,6 +224,7 @@ SOLOCAL void CbmdosInode_tryDestroy(CbmdosInode *self)
     if (!self) return;
     if (self->refcount) return;
     Event_destroy(self->changedEvent);
+    CbmdosInodeSource_release(self->source);
     FileData_destroy(self->data);
     free(self);
 }
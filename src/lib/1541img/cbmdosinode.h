@@ -1,12 +1,29 @@
 #ifndef CBMDOSINODE_H
 #define CBMDOSINODE_H
 
+#include <stddef.h>
+
 #include <1541img/cbmdosinode.h>
 
+C_CLASS_DECL(D64);
+
+/* a snapshot of a disk image, shared by all inodes whose content wasn't
+ * read from it yet */
+typedef struct CbmdosInodeSource CbmdosInodeSource;
+
+CbmdosInodeSource *CbmdosInodeSource_create(D64 *d64);
+void CbmdosInodeSource_release(CbmdosInodeSource *self);
+
 CbmdosInode *CbmdosInode_create(void);
 CbmdosInode *CbmdosInode_clone(const CbmdosInode *other);
 void CbmdosInode_attach(CbmdosInode *self);
 void CbmdosInode_detach(CbmdosInode *self);
 void CbmdosInode_tryDestroy(CbmdosInode *self);
 
+/* makes the content of the inode the first size bytes of the sector chain
+ * starting at track and sector on the source image. The content is only
+ * read on first access. */
+void CbmdosInode_setChain(CbmdosInode *self,
+	CbmdosInodeSource *source, uint8_t track, uint8_t sector, size_t size);
+
 #endif
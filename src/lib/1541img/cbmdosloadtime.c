@@ -0,0 +1,101 @@
+#include <limits.h>
+#include <string.h>
+
+#include "log.h"
+#include "bamdata.h"
+#include "cbmdosfs.h"
+#include <1541img/d64.h>
+#include <1541img/track.h>
+#include <1541img/sector.h>
+
+#include <1541img/cbmdosloadtime.h>
+
+/* Rough figures: the stock loader transfers about 400 bytes per second,
+ * a fastloader reads a block in little more than the time an interleave of
+ * 10 gives it, an IRQ loader is tuned for an interleave of about 4. */
+
+const CbmdosLoadProfile CLP_STOCK = {
+    .rotationTime = 200000,
+    .blockTime = 600000,
+    .stepTime = 15000,
+    .settleTime = 20000,
+    .startTime = 300000
+};
+
+const CbmdosLoadProfile CLP_FASTLOAD = {
+    .rotationTime = 200000,
+    .blockTime = 80000,
+    .stepTime = 6000,
+    .settleTime = 10000,
+    .startTime = 100000
+};
+
+const CbmdosLoadProfile CLP_IRQLOAD = {
+    .rotationTime = 200000,
+    .blockTime = 18000,
+    .stepTime = 3000,
+    .settleTime = 5000,
+    .startTime = 20000
+};
+
+SOEXPORT long estimateChainLoadTime(const D64 *d64, uint8_t track,
+	uint8_t sector, const CbmdosLoadProfile *profile)
+{
+    uint32_t visited[42];
+    memset(visited, 0, sizeof visited);
+
+    unsigned long long rotation = profile->rotationTime;
+    unsigned long long now = profile->startTime;
+    uint8_t headtrack = 18;
+
+    while (track)
+    {
+	const Track *t = D64_rtrack(d64, track);
+	uint8_t sectors = t ? Track_sectors(t) : 0;
+	if (sector >= sectors)
+	{
+	    logmsg(L_WARNING, "estimateChainLoadTime: chain points to "
+		    "invalid sector.");
+	    return -1;
+	}
+	if (bamUsed(visited, track, sector))
+	{
+	    logmsg(L_WARNING, "estimateChainLoadTime: chain contains a loop.");
+	    return -1;
+	}
+	bamAllocate(visited, track, sector);
+
+	if (track != headtrack)
+	{
+	    unsigned distance = track > headtrack ?
+		track - headtrack : headtrack - track;
+	    now += distance * profile->stepTime + profile->settleTime;
+	    headtrack = track;
+	}
+
+	if (rotation)
+	{
+	    unsigned long long angle = now % rotation;
+	    unsigned long long start = rotation * sector / sectors;
+	    now += (start + rotation - angle) % rotation;
+	    now += rotation / sectors;
+	}
+	now += profile->blockTime;
+
+	const uint8_t *content = Sector_rcontent(Track_rsector(t, sector));
+	track = content[0];
+	sector = content[1];
+    }
+
+    if (now > LONG_MAX) return LONG_MAX;
+    return (long)now;
+}
+
+SOEXPORT long estimateFileLoadTime(const CbmdosFs *fs, unsigned pos,
+	const CbmdosLoadProfile *profile)
+{
+    uint8_t track;
+    uint8_t sector;
+    if (CbmdosFs_fileStart(fs, pos, &track, &sector) < 0) return -1;
+    return estimateChainLoadTime(CbmdosFs_image(fs), track, sector, profile);
+}
@@ -3,13 +3,15 @@
 
 #include "util.h"
 #include "log.h"
+#include "cbmdosfile.h"
 #include <1541img/event.h>
-#include <1541img/cbmdosfile.h>
+#include <1541img/cbmdosfileeventargs.h>
 #include <1541img/petscii.h>
 
 #include <1541img/cbmdosvfs.h>
 
 #define DIRCHUNKSIZE 144
+#define NAMEBUCKETS 64
 
 struct CbmdosVfs
 {
@@ -17,24 +19,90 @@ struct CbmdosVfs
     char *id;
     int autoMapToLc;
     CbmdosFile **files;
+    CbmdosFile **buckets;
     Event *changedEvent;
     unsigned fileCount;
     unsigned fileCapa;
+    unsigned bucketCount;
     uint8_t nameLength;
     uint8_t idLength;
     uint8_t dosver;
 };
 
+/* The name index is a hash table chaining the files through their
+ * CbmdosFileVfsLink, which also holds the position of the file. */
+
+static uint32_t nameHash(const char *name, uint8_t length)
+{
+    uint32_t hash = 2166136261U;
+    for (uint8_t i = 0; i < length; ++i)
+    {
+	hash ^= (uint8_t)name[i];
+	hash *= 16777619U;
+    }
+    return hash;
+}
+
+static CbmdosFile **nameBucket(const CbmdosVfs *self, uint32_t hash)
+{
+    return self->buckets + (hash & (self->bucketCount - 1));
+}
+
+static void indexFile(CbmdosVfs *self, CbmdosFile *file)
+{
+    CbmdosFileVfsLink *link = CbmdosFile_vfsLink(file);
+    uint8_t length;
+    const char *name = CbmdosFile_name(file, &length);
+    link->hash = nameHash(name, length);
+    CbmdosFile **bucket = nameBucket(self, link->hash);
+    link->next = *bucket;
+    *bucket = file;
+}
+
+static void unindexFile(CbmdosVfs *self, CbmdosFile *file)
+{
+    CbmdosFileVfsLink *link = CbmdosFile_vfsLink(file);
+    CbmdosFile **entry = nameBucket(self, link->hash);
+    while (*entry != file) entry = &CbmdosFile_vfsLink(*entry)->next;
+    *entry = link->next;
+}
+
+static void growIndex(CbmdosVfs *self)
+{
+    if (self->fileCount <= self->bucketCount) return;
+    while (self->bucketCount < self->fileCount) self->bucketCount <<= 1;
+    free(self->buckets);
+    self->buckets = xmalloc(self->bucketCount * sizeof *self->buckets);
+    memset(self->buckets, 0, self->bucketCount * sizeof *self->buckets);
+    for (unsigned pos = 0; pos < self->fileCount; ++pos)
+    {
+	CbmdosFileVfsLink *link = CbmdosFile_vfsLink(self->files[pos]);
+	CbmdosFile **bucket = nameBucket(self, link->hash);
+	link->next = *bucket;
+	*bucket = self->files[pos];
+    }
+}
+
+static void setPositions(CbmdosVfs *self, unsigned from, unsigned to)
+{
+    for (unsigned pos = from; pos < to; ++pos)
+    {
+	CbmdosFile_vfsLink(self->files[pos])->pos = pos;
+    }
+}
+
 static void fileHandler(void *receiver, int id, const void *sender,
         const void *args)
 {
     (void)id;
 
     CbmdosVfs *self = receiver;
-    unsigned pos;
-    for (pos = 0; pos < self->fileCount; ++pos)
+    const CbmdosFileEventArgs *fea = args;
+    unsigned pos = CbmdosFile_rvfsLink(sender)->pos;
+    if (fea->what == CFE_NAMECHANGED)
     {
-        if (self->files[pos] == sender) break;
+	unindexFile(self, self->files[pos]);
+	indexFile(self, self->files[pos]);
     }
     CbmdosVfsEventArgs ea = {
         .what = CVE_FILECHANGED,
@@ -50,6 +118,9 @@ SOEXPORT CbmdosVfs *CbmdosVfs_create(void)
     memset(self, 0, sizeof *self);
     self->files = xmalloc(DIRCHUNKSIZE * sizeof *self->files);
     self->fileCapa = DIRCHUNKSIZE;
+    self->buckets = xmalloc(NAMEBUCKETS * sizeof *self->buckets);
+    memset(self->buckets, 0, NAMEBUCKETS * sizeof *self->buckets);
+    self->bucketCount = NAMEBUCKETS;
     self->dosver = 0x41;
     self->changedEvent = Event_create(0, self);
     return self;
@@ -188,12 +259,8 @@ SOEXPORT CbmdosFile *CbmdosVfs_file(CbmdosVfs *self, unsigned pos)
 
 SOEXPORT int CbmdosVfs_delete(CbmdosVfs *self, const CbmdosFile *file)
 {
-    unsigned pos;
-    for (pos = 0; pos < self->fileCount; ++pos)
-    {
-        if (self->files[pos] == file) break;
-    }
-    if (pos == self->fileCount)
+    unsigned pos = CbmdosFile_rvfsLink(file)->pos;
+    if (pos >= self->fileCount || self->files[pos] != file)
     {
         logmsg(L_WARNING, "CbmdosVfs_delete: file not found.");
         return -1;
@@ -208,11 +275,13 @@ SOEXPORT int CbmdosVfs_deleteAt(CbmdosVfs *self, unsigned pos)
         logmsg(L_WARNING, "CbmdosVfs_deleteAt: file not found.");
         return -1;
     }
+    unindexFile(self, self->files[pos]);
     CbmdosFile_destroy(self->files[pos]);
     if (pos < --self->fileCount)
     {
         memmove(self->files + pos, self->files + pos + 1,
                 (self->fileCount - pos) * sizeof *self->files);
+	setPositions(self, pos, self->fileCount);
     }
     CbmdosVfsEventArgs args = {
         .what = CVE_FILEDELETED,
@@ -222,16 +291,79 @@ SOEXPORT int CbmdosVfs_deleteAt(CbmdosVfs *self, unsigned pos)
     return 0;
 }
 
-static int ensureSpace(CbmdosVfs *self)
+static int compareUnsigned(const void *a, const void *b)
 {
-    if (self->fileCount == self->fileCapa)
+    unsigned x = *(const unsigned *)a;
+    unsigned y = *(const unsigned *)b;
+    return (x > y) - (x < y);
+}
+
+SOEXPORT int CbmdosVfs_deleteMany(
+	CbmdosVfs *self, const unsigned *positions, unsigned count)
+{
+    if (!count) return 0;
+    unsigned *sorted = xmalloc(count * sizeof *sorted);
+    memcpy(sorted, positions, count * sizeof *sorted);
+    qsort(sorted, count, sizeof *sorted, compareUnsigned);
+    if (sorted[count-1] >= self->fileCount)
     {
-        unsigned newCapa = self->fileCapa + DIRCHUNKSIZE;
-        if (newCapa <= self->fileCapa)
-        {
-            logmsg(L_ERROR, "CbmdosVfs: directory overflow.");
-            return -1;
-        }
+	logmsg(L_WARNING, "CbmdosVfs_deleteMany: file not found.");
+	free(sorted);
+	return -1;
+    }
+    for (unsigned i = 1; i < count; ++i)
+    {
+	if (sorted[i] == sorted[i-1])
+	{
+	    logmsg(L_WARNING, "CbmdosVfs_deleteMany: file given more than "
+		    "once.");
+	    free(sorted);
+	    return -1;
+	}
+    }
+    unsigned to = sorted[0];
+    unsigned next = 0;
+    for (unsigned pos = sorted[0]; pos < self->fileCount; ++pos)
+    {
+	if (next < count && pos == sorted[next])
+	{
+	    unindexFile(self, self->files[pos]);
+	    CbmdosFile_destroy(self->files[pos]);
+	    ++next;
+	}
+	else self->files[to++] = self->files[pos];
+    }
+    self->fileCount = to;
+    setPositions(self, sorted[0], to);
+    CbmdosVfsEventArgs args = {
+	.what = CVE_FILESDELETED,
+	.count = count,
+	.positions = sorted
+    };
+    Event_raise(self->changedEvent, &args);
+    free(sorted);
+    return 0;
+}
+
+static int ensureSpace(CbmdosVfs *self, unsigned count)
+{
+    if (self->fileCount + count < self->fileCount)
+    {
+	logmsg(L_ERROR, "CbmdosVfs: directory overflow.");
+	return -1;
+    }
+    if (self->fileCount + count > self->fileCapa)
+    {
+        unsigned newCapa = self->fileCapa;
+	while (newCapa < self->fileCount + count)
+	{
+	    if (newCapa + DIRCHUNKSIZE <= newCapa)
+	    {
+		logmsg(L_ERROR, "CbmdosVfs: directory overflow.");
+		return -1;
+	    }
+	    newCapa += DIRCHUNKSIZE;
+	}
         CbmdosFile **newFiles = realloc(self->files,
                 newCapa * sizeof *newFiles);
         if (!newFiles)
@@ -247,8 +379,11 @@ static int ensureSpace(CbmdosVfs *self)
 
 SOEXPORT int CbmdosVfs_append(CbmdosVfs *self, CbmdosFile *file)
 {
-    if (ensureSpace(self) < 0) return -1;
+    if (ensureSpace(self, 1) < 0) return -1;
+    CbmdosFile_vfsLink(file)->pos = self->fileCount;
     self->files[self->fileCount++] = file;
+    indexFile(self, file);
+    growIndex(self);
     Event_register(CbmdosFile_changedEvent(file), self, fileHandler);
     CbmdosVfsEventArgs args = {
         .what = CVE_FILEADDED,
@@ -258,13 +393,39 @@ SOEXPORT int CbmdosVfs_append(CbmdosVfs *self, CbmdosFile *file)
     return 0;
 }
 
+SOEXPORT int CbmdosVfs_appendMany(
+	CbmdosVfs *self, CbmdosFile *const *files, unsigned count)
+{
+    if (!count) return 0;
+    if (ensureSpace(self, count) < 0) return -1;
+    unsigned first = self->fileCount;
+    for (unsigned i = 0; i < count; ++i)
+    {
+	CbmdosFile_vfsLink(files[i])->pos = self->fileCount;
+	self->files[self->fileCount++] = files[i];
+	indexFile(self, files[i]);
+	Event_register(CbmdosFile_changedEvent(files[i]), self, fileHandler);
+    }
+    growIndex(self);
+    CbmdosVfsEventArgs args = {
+	.what = CVE_FILESADDED,
+	.filepos = first,
+	.count = count
+    };
+    Event_raise(self->changedEvent, &args);
+    return 0;
+}
+
 SOEXPORT int CbmdosVfs_insert(CbmdosVfs *self, CbmdosFile *file, unsigned pos)
 {
     if (pos >= self->fileCount) return CbmdosVfs_append(self, file);
-    if (ensureSpace(self) < 0) return -1;
+    if (ensureSpace(self, 1) < 0) return -1;
     memmove(self->files + pos + 1, self->files + pos,
             (self->fileCount++ - pos) * sizeof *self->files);
     self->files[pos] = file;
+    setPositions(self, pos, self->fileCount);
+    indexFile(self, file);
+    growIndex(self);
     Event_register(CbmdosFile_changedEvent(file), self, fileHandler);
     CbmdosVfsEventArgs args = {
         .what = CVE_FILEADDED,
@@ -291,6 +452,8 @@ SOEXPORT int CbmdosVfs_move(CbmdosVfs *self, unsigned to, unsigned from)
 		(from - to) * sizeof *self->files);
     }
     self->files[to] = tmp;
+    if (to > from) setPositions(self, from, to + 1);
+    else setPositions(self, to, from + 1);
     CbmdosVfsEventArgs args = {
 	.what = CVE_FILEMOVED,
 	.filepos = from,
@@ -300,6 +463,187 @@ SOEXPORT int CbmdosVfs_move(CbmdosVfs *self, unsigned to, unsigned from)
     return 0;
 }
 
+static void applyOrder(CbmdosVfs *self, const unsigned *permutation)
+{
+    unsigned pos;
+    for (pos = 0; pos < self->fileCount; ++pos)
+    {
+	if (permutation[pos] != pos) break;
+    }
+    if (pos == self->fileCount) return;
+    CbmdosFile **files = xmalloc(self->fileCount * sizeof *files);
+    for (pos = 0; pos < self->fileCount; ++pos)
+    {
+	files[pos] = self->files[permutation[pos]];
+    }
+    memcpy(self->files, files, self->fileCount * sizeof *files);
+    free(files);
+    setPositions(self, 0, self->fileCount);
+    CbmdosVfsEventArgs args = {
+	.what = CVE_FILESREORDERED,
+	.count = self->fileCount,
+	.positions = permutation
+    };
+    Event_raise(self->changedEvent, &args);
+}
+
+SOEXPORT int CbmdosVfs_reorder(
+	CbmdosVfs *self, const unsigned *permutation)
+{
+    if (!self->fileCount) return 0;
+    uint8_t *seen = xmalloc(self->fileCount);
+    memset(seen, 0, self->fileCount);
+    for (unsigned pos = 0; pos < self->fileCount; ++pos)
+    {
+	if (permutation[pos] >= self->fileCount || seen[permutation[pos]])
+	{
+	    logmsg(L_WARNING, "CbmdosVfs_reorder: invalid permutation.");
+	    free(seen);
+	    return -1;
+	}
+	seen[permutation[pos]] = 1;
+    }
+    free(seen);
+    applyOrder(self, permutation);
+    return 0;
+}
+
+static void mergeSort(unsigned *order, unsigned *tmp, unsigned n,
+	CbmdosFile *const *files, CbmdosFileComparer compare, void *ctx)
+{
+    if (n < 2) return;
+    unsigned half = n / 2;
+    mergeSort(order, tmp, half, files, compare, ctx);
+    mergeSort(order + half, tmp, n - half, files, compare, ctx);
+    unsigned l = 0;
+    unsigned r = half;
+    unsigned out = 0;
+    while (l < half && r < n)
+    {
+	if (compare(files[order[r]], files[order[l]], ctx) < 0)
+	{
+	    tmp[out++] = order[r++];
+	}
+	else tmp[out++] = order[l++];
+    }
+    while (l < half) tmp[out++] = order[l++];
+    memcpy(order, tmp, out * sizeof *order);
+}
+
+SOEXPORT void CbmdosVfs_sort(
+	CbmdosVfs *self, CbmdosFileComparer compare, void *ctx)
+{
+    if (self->fileCount < 2) return;
+    unsigned *order = xmalloc(2 * self->fileCount * sizeof *order);
+    for (unsigned pos = 0; pos < self->fileCount; ++pos)
+    {
+	order[pos] = pos;
+    }
+    mergeSort(order, order + self->fileCount, self->fileCount,
+	    self->files, compare, ctx);
+    applyOrder(self, order);
+    free(order);
+}
+
+static int hasWildcards(const char *pattern, uint8_t length)
+{
+    for (uint8_t i = 0; i < length; ++i)
+    {
+	if (pattern[i] == '*' || pattern[i] == '?') return 1;
+    }
+    return 0;
+}
+
+static int nameMatches(const char *pattern, uint8_t patternLength,
+	const CbmdosFile *file)
+{
+    uint8_t length;
+    const char *name = CbmdosFile_name(file, &length);
+    uint8_t i;
+    for (i = 0; i < patternLength; ++i)
+    {
+	if (pattern[i] == '*') return 1;
+	if (i == length) return 0;
+	if (pattern[i] != '?' && pattern[i] != name[i]) return 0;
+    }
+    return i == length;
+}
+
+/* calls found for every file with exactly the given name, in no specific
+ * order */
+static void findExact(const CbmdosVfs *self, const char *name,
+	uint8_t length, void (*found)(unsigned, void *), void *ctx)
+{
+    uint32_t hash = nameHash(name, length);
+    for (const CbmdosFile *file = *nameBucket(self, hash); file;
+	    file = CbmdosFile_rvfsLink(file)->next)
+    {
+	const CbmdosFileVfsLink *link = CbmdosFile_rvfsLink(file);
+	if (link->hash == hash && nameMatches(name, length, file))
+	{
+	    found(link->pos, ctx);
+	}
+    }
+}
+
+static void foundFirst(unsigned pos, void *ctx)
+{
+    int *first = ctx;
+    if (*first < 0 || pos < (unsigned)*first) *first = (int)pos;
+}
+
+typedef struct FoundList
+{
+    unsigned *positions;
+    unsigned count;
+} FoundList;
+
+static void foundAll(unsigned pos, void *ctx)
+{
+    FoundList *list = ctx;
+    if (list->positions) list->positions[list->count] = pos;
+    ++list->count;
+}
+
+SOEXPORT int CbmdosVfs_find(
+	const CbmdosVfs *self, const char *pattern, uint8_t length)
+{
+    int first = -1;
+    if (!hasWildcards(pattern, length))
+    {
+	findExact(self, pattern, length, foundFirst, &first);
+	return first;
+    }
+    for (unsigned pos = 0; pos < self->fileCount; ++pos)
+    {
+	if (nameMatches(pattern, length, self->files[pos])) return (int)pos;
+    }
+    return -1;
+}
+
+SOEXPORT unsigned CbmdosVfs_findAll(const CbmdosVfs *self,
+	const char *pattern, uint8_t length, unsigned *positions)
+{
+    FoundList list = { positions, 0 };
+    if (!hasWildcards(pattern, length))
+    {
+	findExact(self, pattern, length, foundAll, &list);
+	if (positions && list.count > 1)
+	{
+	    qsort(positions, list.count, sizeof *positions, compareUnsigned);
+	}
+	return list.count;
+    }
+    for (unsigned pos = 0; pos < self->fileCount; ++pos)
+    {
+	if (nameMatches(pattern, length, self->files[pos]))
+	{
+	    foundAll(pos, &list);
+	}
+    }
+    return list.count;
+}
+
 SOEXPORT void CbmdosVfs_getDirHeader(const CbmdosVfs *self, uint8_t *line)
 {
     memset(line, 0xa0, 24);
@@ -342,6 +686,7 @@ SOEXPORT void CbmdosVfs_destroy(CbmdosVfs *self)
         CbmdosFile_destroy(self->files[pos]);
     }
     Event_destroy(self->changedEvent);
+    free(self->buckets);
     free(self->files);
     free(self->name);
     free(self->id);
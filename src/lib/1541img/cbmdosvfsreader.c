@@ -3,51 +3,33 @@
 #include "util.h"
 #include "log.h"
 #include "dirdata.h"
+#include "bamdata.h"
+#include "cbmdosfile.h"
 #include <1541img/d64.h>
 #include <1541img/track.h>
 #include <1541img/sector.h>
 #include <1541img/filedata.h>
-#include <1541img/cbmdosfile.h>
 #include <1541img/cbmdosvfs.h>
 #include <1541img/cbmdosfs.h>
 
 #include "cbmdosvfsreader.h"
 
-static int parseTrackBam(uint8_t *bamdata, uint8_t sectors,
+static int parseTrackBam(uint32_t *bamdata, uint8_t sectors,
 	const uint8_t *trackbam)
 {
-    uint8_t tmp[21] = {0};
-    uint8_t sectfree = 0;
-    for (uint8_t sectno = 0; sectno < sectors; ++sectno)
-    {
-	if (trackbam[1+sectno/8] & (1U << (sectno%8)))
-	{
-	    ++sectfree;
-	}
-	else
-	{
-	    tmp[sectno] = 1;
-	}
-    }
-    if (bamdata) memcpy(bamdata, tmp, 21);
-    if (sectfree != trackbam[0]) return -1;
+    uint32_t mask = bamTrackMask(sectors);
+    uint32_t freemap = (trackbam[1] | (uint32_t)trackbam[2] << 8
+	    | (uint32_t)trackbam[3] << 16) & mask;
+    if (bamdata) *bamdata = ~freemap & mask;
+    if (bamCount(freemap) != trackbam[0]) return -1;
     return 0;
 }
 
-SOLOCAL int readCbmdosVfsInternal(CbmdosVfs *vfs, const D64 *d64,
-	const CbmdosFsOptions *options,
-	uint8_t (*bamdata)[21], DirData *dirdata)
+static void readHeader(CbmdosVfs *vfs, const uint8_t *bam, CbmdosFsFlags flags)
 {
-    if (CbmdosVfs_fileCount(vfs))
-    {
-        logmsg(L_ERROR, "readCbmdosVfs: called with non-empty vfs.");
-        return -1;
-    }
-
-    const uint8_t *bam = Sector_rcontent(D64_rsector(d64, 18, 0));
     CbmdosVfs_setDosver(vfs, bam[2]);
     uint8_t nameoffset = 0;
-    if (options->flags & CFF_PROLOGICDOSBAM) nameoffset = 0x14;
+    if (flags & CFF_PROLOGICDOSBAM) nameoffset = 0x14;
     uint8_t namelen = 16;
     while (namelen && bam[namelen + 0x8f + nameoffset] == 0xa0) --namelen;
     CbmdosVfs_setName(vfs, (const char *)bam+0x90+nameoffset, namelen);
@@ -70,6 +52,202 @@ SOLOCAL int readCbmdosVfsInternal(CbmdosVfs *vfs, const D64 *d64,
 	}
     }
     CbmdosVfs_setId(vfs, (const char *)bam+0xa2+nameoffset, idlen);
+}
+
+/* evidence for options from the tracks used by files or the directory */
+static void probeTrack(CbmdosFsOptions *probeopts, uint8_t track, int isdir)
+{
+    if (track > 40)
+    {
+	probeopts->flags &= ~CFF_40TRACK;
+	probeopts->flags |= CFF_42TRACK;
+    }
+    else if (track > 35 && !(probeopts->flags & CFF_42TRACK))
+    {
+	probeopts->flags |= CFF_40TRACK;
+    }
+    else if (track == 18)
+    {
+	if (!isdir) probeopts->flags |= CFF_FILESONDIRTRACK;
+    }
+    else if (isdir)
+    {
+	probeopts->flags |= CFF_ALLOWLONGDIR;
+    }
+}
+
+/* candidates for extended BAM formats, checked against the blocks actually
+ * used on tracks 36 to 40 by probeFinish() */
+static void probeBam(CbmdosFsOptions *probeopts, const D64 *d64,
+	uint32_t *bamprobedolphin, uint32_t *bamprobespeed)
+{
+    const uint8_t *bam = Sector_rcontent(D64_rsector(d64, 18, 0));
+    if (D64_tracks(d64) > 35)
+    {
+	if (bam[2] == 0x50)
+	{
+	    probeopts->flags |= CFF_PROLOGICDOSBAM;
+	    for (uint8_t trackno = 36; trackno < 41; ++trackno)
+	    {
+		uint8_t sectors = Track_sectors(D64_rtrack(d64, trackno));
+		parseTrackBam(bamprobespeed + trackno-36,
+			sectors, bam + 4*trackno);
+	    }
+	}
+	else
+	{
+	    int dolphinok = 1;
+	    int speedok = 1;
+	    for (uint8_t trackno = 36; trackno < 41; ++trackno)
+	    {
+		uint8_t sectors = Track_sectors(D64_rtrack(d64, trackno));
+		if (parseTrackBam(bamprobedolphin + trackno-36,
+			    sectors, bam + 0x1c + 4*trackno) < 0)
+		{
+		    dolphinok = 0;
+		}
+		if (parseTrackBam(bamprobespeed + trackno-36,
+			    sectors, bam + 0x30 + 4*trackno) < 0)
+		{
+		    speedok = 0;
+		}
+	    }
+	    if (dolphinok)
+	    {
+		probeopts->flags |= CFF_DOLPHINDOSBAM;
+	    }
+	    if (speedok)
+	    {
+		probeopts->flags |= CFF_SPEEDDOSBAM;
+	    }
+	}
+    }
+}
+
+static void probeFinish(CbmdosFsOptions *probeopts, const D64 *d64,
+	const uint32_t *rdmap, const uint32_t *bamprobedolphin,
+	const uint32_t *bamprobespeed)
+{
+    const uint8_t *bam = Sector_rcontent(D64_rsector(d64, 18, 0));
+    if ((probeopts->flags & CFF_DOLPHINDOSBAM)
+	    && memcmp(rdmap+35, bamprobedolphin, 5 * sizeof *rdmap))
+    {
+	probeopts->flags &= ~CFF_DOLPHINDOSBAM;
+    }
+    if ((probeopts->flags & CFF_SPEEDDOSBAM)
+	    && memcmp(rdmap+35, bamprobespeed, 5 * sizeof *rdmap))
+    {
+	probeopts->flags &= ~CFF_SPEEDDOSBAM;
+    }
+    if ((probeopts->flags & CFF_PROLOGICDOSBAM)
+	    && memcmp(rdmap+35, bamprobespeed, 5 * sizeof *rdmap))
+    {
+	probeopts->flags &= ~CFF_PROLOGICDOSBAM;
+    }
+
+    int hasfreeblocks = 0;
+    for (uint8_t trackno = 1;
+	    trackno < (D64_type(d64) == D64_STANDARD ? 36 : 41); ++trackno)
+    {
+	uint8_t sectors = Track_sectors(D64_rtrack(d64, trackno));
+	if (rdmap[trackno-1] != bamTrackMask(sectors))
+	{
+	    hasfreeblocks = 1;
+	    break;
+	}
+    }
+
+    if (hasfreeblocks)
+    {
+	int zerofree = 1;
+	for (uint8_t trackno = 1; trackno < 36; ++trackno)
+	{
+	    if (bam[4*trackno])
+	    {
+		zerofree = 0;
+		break;
+	    }
+	}
+
+	if (D64_type(d64) == D64_STANDARD)
+	{
+	    if (zerofree) probeopts->flags |= CFF_ZEROFREE;
+	}
+	else if (zerofree)
+	{
+	    if (probeopts->flags & CFF_PROLOGICDOSBAM)
+	    {
+		for (uint8_t trackno = 36; trackno < 41; ++trackno)
+		{
+		    if (bam[4*trackno])
+		    {
+			zerofree = 0;
+			break;
+		    }
+		}
+		if (zerofree) probeopts->flags |= CFF_ZEROFREE;
+	    }
+	    else
+	    {
+		int havedolphin = 0;
+		int havespeed = 0;
+		if (!memcmp(rdmap+35, bamprobedolphin, 5 * sizeof *rdmap))
+		{
+		    havedolphin = 1;
+		    for (uint8_t trackno = 36; trackno < 41; ++trackno)
+		    {
+			if (bam[4*trackno + 0x1c])
+			{
+			    zerofree = 0;
+			    break;
+			}
+		    }
+		}
+		if (!memcmp(rdmap+35, bamprobespeed, 5 * sizeof *rdmap))
+		{
+		    havespeed = 1;
+		    for (uint8_t trackno = 36; trackno < 41; ++trackno)
+		    {
+			if (bam[4*trackno + 0x30])
+			{
+			    zerofree = 0;
+			    break;
+			}
+		    }
+		}
+		if (zerofree)
+		{
+		    probeopts->flags |= CFF_ZEROFREE;
+		    if (havedolphin) probeopts->flags |= CFF_DOLPHINDOSBAM;
+		    if (havespeed) probeopts->flags |= CFF_SPEEDDOSBAM;
+		}
+	    }
+	}
+    }
+}
+
+/* reads the vfs. If probeopts is given, options must allow everything the
+ * image could contain, evidence for the options actually needed is
+ * collected in probeopts while reading. If lazyd64 is given, it must be the
+ * same image as d64, file contents are then read from a snapshot of it on
+ * first access. */
+static int readVfs(CbmdosVfs *vfs, const D64 *d64, D64 *lazyd64,
+	const CbmdosFsOptions *options, CbmdosFsOptions *probeopts,
+	uint32_t *bamdata, DirData *dirdata)
+{
+    if (CbmdosVfs_fileCount(vfs))
+    {
+        logmsg(L_ERROR, "readCbmdosVfs: called with non-empty vfs.");
+        return -1;
+    }
+
+    const uint8_t *bam = Sector_rcontent(D64_rsector(d64, 18, 0));
+    if (!probeopts) readHeader(vfs, bam, options->flags);
+
+    uint32_t bamprobedolphin[5] = { 0 };
+    uint32_t bamprobespeed[5] = { 0 };
+    if (probeopts) probeBam(probeopts, d64, bamprobedolphin, bamprobespeed);
+    int firstfile = 1;
 
     int rc = 0;
     if (bamdata)
@@ -79,7 +257,7 @@ SOLOCAL int readCbmdosVfsInternal(CbmdosVfs *vfs, const D64 *d64,
 	    uint8_t sectors = Track_sectors(D64_rtrack(d64, trackno));
 	    if (trackno < 36)
 	    {
-		if (parseTrackBam(bamdata[trackno-1], sectors,
+		if (parseTrackBam(bamdata + trackno-1, sectors,
 			    bam + 4*trackno) < 0)
 		{
 		    if (!(options->flags & CFF_ZEROFREE)) rc = -2;
@@ -90,7 +268,7 @@ SOLOCAL int readCbmdosVfsInternal(CbmdosVfs *vfs, const D64 *d64,
 	    {
 		if (options->flags & CFF_DOLPHINDOSBAM)
 		{
-		    if (parseTrackBam(bamdata[trackno-1], sectors,
+		    if (parseTrackBam(bamdata + trackno-1, sectors,
 				bam + 0x1c + 4*trackno) < 0)
 		    {
 			if (!(options->flags & CFF_ZEROFREE)) rc = -2;
@@ -98,7 +276,7 @@ SOLOCAL int readCbmdosVfsInternal(CbmdosVfs *vfs, const D64 *d64,
 		}
 		if (options->flags & CFF_SPEEDDOSBAM)
 		{
-		    if (parseTrackBam(bamdata[trackno-1], sectors,
+		    if (parseTrackBam(bamdata + trackno-1, sectors,
 				bam + 0x30 + 4*trackno) < 0)
 		    {
 			if (!(options->flags & CFF_ZEROFREE)) rc = -2;
@@ -106,7 +284,7 @@ SOLOCAL int readCbmdosVfsInternal(CbmdosVfs *vfs, const D64 *d64,
 		}
 		if (options->flags & CFF_PROLOGICDOSBAM)
 		{
-		    if (parseTrackBam(bamdata[trackno-1], sectors,
+		    if (parseTrackBam(bamdata + trackno-1, sectors,
 				bam + 4*trackno) < 0)
 		    {
 			if (!(options->flags & CFF_ZEROFREE)) rc = -2;
@@ -122,9 +300,11 @@ SOLOCAL int readCbmdosVfsInternal(CbmdosVfs *vfs, const D64 *d64,
 
     const Sector *dirsect = D64_rsector(d64, 18, 1);
 
-    uint8_t rdmap[42][21] = { { 0 } };
-    rdmap[17][0] = 1;
-    rdmap[17][1] = 1;
+    uint32_t rdmap[42] = { 0 };
+    rdmap[17] = 3;
+
+    int lazy = !!lazyd64;
+    CbmdosInodeSource *source = 0;
 
     while (dirsect)
     {
@@ -136,8 +316,15 @@ SOLOCAL int readCbmdosVfsInternal(CbmdosVfs *vfs, const D64 *d64,
             {
                 CbmdosFileType type = direntry[2] & 0xf;
 		int typeInvalid = 0;
+		int dropFile = 0;
                 int locked = !!(direntry[2] & (1<<6));
                 int closed = !!(direntry[2] & (1<<7));
+		if (probeopts && firstfile && type != CFT_DEL
+			&& direntry[3] == 18 && direntry[4] > 1)
+		{
+		    probeopts->flags |= CFF_TALLOC_PREFDIRTRACK;
+		}
+		firstfile = 0;
                 CbmdosFile *file = CbmdosFile_create();
                 if (CbmdosFile_setType(file, type) < 0)
                 {
@@ -145,6 +332,14 @@ SOLOCAL int readCbmdosVfsInternal(CbmdosVfs *vfs, const D64 *d64,
 		    {
 			typeInvalid = 1;
 		    }
+		    else if (probeopts)
+		    {
+			logmsg(L_ERROR, "readCbmdosVfs: invalid file type "
+				"found.");
+			CbmdosFile_destroy(file);
+			rc = -1;
+			goto done;
+		    }
 		    else
 		    {
 			CbmdosFile_destroy(file);
@@ -157,8 +352,14 @@ SOLOCAL int readCbmdosVfsInternal(CbmdosVfs *vfs, const D64 *d64,
                 {
                     if (CbmdosFile_setRecordLength(file, direntry[0x17]) < 0)
                     {
-                        CbmdosFile_destroy(file);
-                        continue;
+			/* when probing, the blocks of the chain still count
+			 * as used, so walk it before dropping the file */
+			if (!probeopts)
+			{
+			    CbmdosFile_destroy(file);
+			    continue;
+			}
+			dropFile = 1;
                     }
                 }
                 uint8_t filenamelen = 16;
@@ -170,6 +371,7 @@ SOLOCAL int readCbmdosVfsInternal(CbmdosVfs *vfs, const D64 *d64,
 			CbmdosFileType_name(CbmdosFile_type(file)));
 
 		uint16_t blocks = (direntry[0x1f] << 8) | direntry[0x1e];
+		size_t lazysize = 0;
 		if (dirdata)
 		{
 		    if (dirdata->size == dirdata->capa)
@@ -191,6 +393,7 @@ SOLOCAL int readCbmdosVfsInternal(CbmdosVfs *vfs, const D64 *d64,
                             = direntry[4];
                     }
 		    dirdata->entries[dirdata->size].blocks = blocks;
+		    dirdata->entries[dirdata->size].unplaced = 0;
                     if (type == CFT_REL)
                     {
                         dirdata->entries[dirdata->size].sidetrack
@@ -209,6 +412,9 @@ SOLOCAL int readCbmdosVfsInternal(CbmdosVfs *vfs, const D64 *d64,
 		if (typeInvalid || type != CFT_DEL)
 		{
 		    FileData *data = CbmdosFile_data(file);
+		    size_t maxblocks = D64_size(d64) / 256;
+		    if (!lazy) FileData_reserve(data,
+			    (blocks < maxblocks ? blocks : maxblocks) * 254);
 		    uint8_t track = direntry[3];
 		    uint8_t sector = direntry[4];
                     if (track == 18 && (sector == 0 || sector == 1))
@@ -218,6 +424,7 @@ SOLOCAL int readCbmdosVfsInternal(CbmdosVfs *vfs, const D64 *d64,
                     int doingsidesects = 0;
 		    while (track)
 		    {
+			if (probeopts) probeTrack(probeopts, track, 0);
 			if (track > maxtrack)
 			{
 			    logfmt(L_ERROR, "readCbmdosVfs: invalid track "
@@ -256,7 +463,7 @@ SOLOCAL int readCbmdosVfsInternal(CbmdosVfs *vfs, const D64 *d64,
 			    rc = -1;
 			    break;
 			}
-                        if (rdmap[track-1][sector])
+                        if (bamUsed(rdmap, track, sector))
                         {
                             logmsg(L_ERROR,
                                     "readCbmdosVfs: corrupt filesystem.");
@@ -267,10 +474,10 @@ SOLOCAL int readCbmdosVfsInternal(CbmdosVfs *vfs, const D64 *d64,
 			    rc = -1;
                             break;
                         }
-                        rdmap[track-1][sector] = 1;
+                        bamAllocate(rdmap, track, sector);
 			if (track > 40 && bamdata)
 			{
-			    bamdata[track-1][sector] = 1;
+			    bamAllocate(bamdata, track, sector);
 			}
 			const uint8_t *sectorbytes = Sector_rcontent(
 				D64_rsector(d64, track, sector));
@@ -280,8 +487,15 @@ SOLOCAL int readCbmdosVfsInternal(CbmdosVfs *vfs, const D64 *d64,
                         {
                             size_t appendsize = 254;
                             if (!track) appendsize = sector-1;
-                            if (FileData_append(data, sectorbytes+2,
-                                        appendsize) < 0)
+                            int appendfailed;
+                            if (lazy)
+                            {
+                                appendfailed = appendsize > 254;
+                                lazysize += appendsize;
+                            }
+                            else appendfailed = FileData_append(data,
+                                    sectorbytes+2, appendsize) < 0;
+                            if (appendfailed)
                             {
                                 logmsg(L_ERROR, "readCbmdosVfs: error "
                                         "appending to file.");
@@ -300,8 +514,19 @@ SOLOCAL int readCbmdosVfsInternal(CbmdosVfs *vfs, const D64 *d64,
                         }
 		    }
 		}
-nextfile:	if (file)
+nextfile:	if (file && dropFile)
+		{
+		    CbmdosFile_destroy(file);
+		    file = 0;
+		}
+		if (file)
                 {
+		    if (lazysize)
+		    {
+			if (!source) source = CbmdosInodeSource_create(lazyd64);
+			CbmdosFile_setChain(file, source,
+				direntry[3], direntry[4], lazysize);
+		    }
 		    if (CbmdosFile_realBlocks(file) != blocks)
 		    {
 			CbmdosFile_setForcedBlocks(file, blocks);
@@ -323,7 +548,7 @@ nextfile:	if (file)
 		if (options->flags & CFF_RECOVER) goto done;
 		rc = -1;
             }
-	    else if (rdmap[dirbytes[0]-1][dirbytes[1]])
+	    else if (bamUsed(rdmap, dirbytes[0], dirbytes[1]))
             {
                 logmsg(L_ERROR, "readCbmdosVfs: corrupt filesystem.");
 		if (!(options->flags & CFF_RECOVER))
@@ -350,10 +575,11 @@ nextfile:	if (file)
 	    }
 	    if (rc == 0)
 	    {
-		rdmap[dirbytes[0]-1][dirbytes[1]] = 1;
+		if (probeopts) probeTrack(probeopts, dirbytes[0], 1);
+		bamAllocate(rdmap, dirbytes[0], dirbytes[1]);
 		if (dirbytes[0] > 40 && bamdata)
 		{
-		    bamdata[dirbytes[0]-1][dirbytes[1]] = 1;
+		    bamAllocate(bamdata, dirbytes[0], dirbytes[1]);
 		}
 	    }
         }
@@ -361,87 +587,69 @@ nextfile:	if (file)
     }
 
 done:
+    CbmdosInodeSource_release(source);
+    if (probeopts)
+    {
+	probeFinish(probeopts, d64, rdmap, bamprobedolphin, bamprobespeed);
+	readHeader(vfs, bam, probeopts->flags);
+    }
     if (rc == 0 && bamdata)
     {
 	for (uint8_t track = 0; track < maxtrack; ++track)
-	    for (uint8_t sect = 0; sect < 21; ++sect)
-		if (bamdata[track][sect] != rdmap[track][sect])
-		    return -2;
+	    if (bamdata[track] != rdmap[track]) return -2;
     }
 
     return rc;
 }
 
-SOEXPORT int readCbmdosVfs(CbmdosVfs *vfs, const D64 *d64,
+SOLOCAL int readCbmdosVfsInternal(CbmdosVfs *vfs, D64 *d64,
+	const CbmdosFsOptions *options,
+	uint32_t *bamdata, DirData *dirdata)
+{
+    return readVfs(vfs, d64, (options->flags & CFF_LAZYCONTENT) ? d64 : 0,
+	    options, 0, bamdata, dirdata);
+}
+
+static int readOrProbe(CbmdosVfs *vfs, const D64 *d64, D64 *lazyd64,
 	const CbmdosFsOptions *options)
 {
+    if (options) return readVfs(vfs, d64, lazyd64, options, 0, 0, 0);
+
+    /* read with options allowing anything and probe in the same pass */
     CbmdosFsOptions probeopts = CFO_DEFAULT;
-    if (!options)
-    {
-	if (probeCbmdosFsOptions(&probeopts, d64) < 0) return -1;
-	options = &probeopts;
-    }
-    return readCbmdosVfsInternal(vfs, d64, options, 0, 0);
+    CbmdosFsOptions readopts = CFO_DEFAULT;
+    readopts.flags |= CFF_ALLOWLONGDIR | CFF_FILESONDIRTRACK;
+    if (D64_tracks(d64) > 40) readopts.flags |= CFF_42TRACK;
+    else if (D64_tracks(d64) > 35) readopts.flags |= CFF_40TRACK;
+    return readVfs(vfs, d64, lazyd64, &readopts, &probeopts, 0, 0);
+}
+
+SOEXPORT int readCbmdosVfs(CbmdosVfs *vfs, const D64 *d64,
+	const CbmdosFsOptions *options)
+{
+    return readOrProbe(vfs, d64, 0, options);
+}
+
+SOEXPORT int readCbmdosVfsLazy(CbmdosVfs *vfs, D64 *d64,
+	const CbmdosFsOptions *options)
+{
+    return readOrProbe(vfs, d64, d64, options);
 }
 
 SOEXPORT int probeCbmdosFsOptions(CbmdosFsOptions *options, const D64 *d64)
 {
     CbmdosFsOptions probeopts = CFO_DEFAULT;
-    if (options->flags & CFF_RECOVER)
-    {
-	probeopts.flags |= CFF_RECOVER;
-    }
+    probeopts.flags |= options->flags & (CFF_RECOVER | CFF_LAZYCONTENT);
 
-    uint8_t bamprobedolphin[5][21] = {{ 0 }};
-    uint8_t bamprobespeed[5][21] = {{ 0 }};
+    uint32_t bamprobedolphin[5] = { 0 };
+    uint32_t bamprobespeed[5] = { 0 };
 
-    const uint8_t *bam = Sector_rcontent(D64_rsector(d64, 18, 0));
-    if (D64_tracks(d64) > 35)
-    {
-	if (bam[2] == 0x50)
-	{
-	    probeopts.flags |= CFF_PROLOGICDOSBAM;
-	    for (uint8_t trackno = 36; trackno < 41; ++trackno)
-	    {
-		uint8_t sectors = Track_sectors(D64_rtrack(d64, trackno));
-		parseTrackBam(bamprobespeed[trackno-36],
-			sectors, bam + 4*trackno);
-	    }
-	}
-	else
-	{
-	    int dolphinok = 1;
-	    int speedok = 1;
-	    for (uint8_t trackno = 36; trackno < 41; ++trackno)
-	    {
-		uint8_t sectors = Track_sectors(D64_rtrack(d64, trackno));
-		if (parseTrackBam(bamprobedolphin[trackno-36],
-			    sectors, bam + 0x1c + 4*trackno) < 0)
-		{
-		    dolphinok = 0;
-		}
-		if (parseTrackBam(bamprobespeed[trackno-36],
-			    sectors, bam + 0x30 + 4*trackno) < 0)
-		{
-		    speedok = 0;
-		}
-	    }
-	    if (dolphinok)
-	    {
-		probeopts.flags |= CFF_DOLPHINDOSBAM;
-	    }
-	    if (speedok)
-	    {
-		probeopts.flags |= CFF_SPEEDDOSBAM;
-	    }
-	}
-    }
+    probeBam(&probeopts, d64, bamprobedolphin, bamprobespeed);
 
     const Sector *dirsect = D64_rsector(d64, 18, 1);
 
-    uint8_t rdmap[42][21] = { { 0 } };
-    rdmap[17][0] = 1;
-    rdmap[17][1] = 1;
+    uint32_t rdmap[42] = { 0 };
+    rdmap[17] = 3;
 
     int firstfile = 1;
     while (dirsect)
@@ -478,19 +686,7 @@ SOEXPORT int probeCbmdosFsOptions(CbmdosFsOptions *options, const D64 *d64)
                     int doingsidesects = 0;
 		    while (track)
 		    {
-			if (track > 40)
-			{
-			    probeopts.flags &= ~CFF_40TRACK;
-			    probeopts.flags |= CFF_42TRACK;
-			}
-			else if (track > 35 && !(probeopts.flags & CFF_42TRACK))
-			{
-			    probeopts.flags |= CFF_40TRACK;
-			}
-			else if (track == 18)
-			{
-			    probeopts.flags |= CFF_FILESONDIRTRACK;
-			}
+			probeTrack(&probeopts, track, 0);
 			const Sector *filesector = D64_rsector(
 				d64, track, sector);
 			if (!filesector)
@@ -501,14 +697,14 @@ SOEXPORT int probeCbmdosFsOptions(CbmdosFsOptions *options, const D64 *d64)
 			    if (probeopts.flags & CFF_RECOVER) goto nextfile;
 			    return -1;
 			}
-                        if (rdmap[track-1][sector])
+                        if (bamUsed(rdmap, track, sector))
                         {
 			    logmsg(L_ERROR, "probeCbmdosFsOptions: "
 				    "corrupt filesystem, sector used twice.");
 			    if (probeopts.flags & CFF_RECOVER) goto nextfile;
 			    return -1;
                         }
-                        rdmap[track-1][sector] = 1;
+                        bamAllocate(rdmap, track, sector);
 			const uint8_t *sectorbytes = Sector_rcontent(
 				D64_rsector(d64, track, sector));
 			track = sectorbytes[0];
@@ -535,131 +731,19 @@ nextfile:
 		if (probeopts.flags & CFF_RECOVER) goto done;
 		return -1;
             }
-	    if (rdmap[dirbytes[0]-1][dirbytes[1]])
+	    if (bamUsed(rdmap, dirbytes[0], dirbytes[1]))
             {
                 logmsg(L_ERROR, "probeCbmdosFsOptions: corrupt filesystem, "
 			"sector used twice.");
                 if (!(probeopts.flags & CFF_RECOVER)) return -1;
             }
-	    if (dirbytes[0] > 40)
-	    {
-		probeopts.flags &= ~CFF_40TRACK;
-		probeopts.flags |= CFF_42TRACK;
-	    }
-	    else if (dirbytes[0] > 35 && !(probeopts.flags & CFF_42TRACK))
-	    {
-		probeopts.flags |= CFF_40TRACK;
-	    }
-	    else if (dirbytes[0] != 18)
-	    {
-		probeopts.flags |= CFF_ALLOWLONGDIR;
-	    }
-	    rdmap[dirbytes[0]-1][dirbytes[1]] = 1;
+	    probeTrack(&probeopts, dirbytes[0], 1);
+	    bamAllocate(rdmap, dirbytes[0], dirbytes[1]);
         }
         else dirsect = 0;
     }
 
-    if ((probeopts.flags & CFF_DOLPHINDOSBAM)
-	    && memcmp(rdmap+35, bamprobedolphin, sizeof bamprobedolphin))
-    {
-	probeopts.flags &= ~CFF_DOLPHINDOSBAM;
-    }
-    if ((probeopts.flags & CFF_SPEEDDOSBAM)
-	    && memcmp(rdmap+35, bamprobespeed, sizeof bamprobespeed))
-    {
-	probeopts.flags &= ~CFF_SPEEDDOSBAM;
-    }
-    if ((probeopts.flags & CFF_PROLOGICDOSBAM)
-	    && memcmp(rdmap+35, bamprobespeed, sizeof bamprobespeed))
-    {
-	probeopts.flags &= ~CFF_PROLOGICDOSBAM;
-    }
-
-    int hasfreeblocks = 0;
-    for (uint8_t trackno = 1;
-	    trackno < (D64_type(d64) == D64_STANDARD ? 36 : 41); ++trackno)
-    {
-	uint8_t sectors = Track_sectors(D64_rtrack(d64, trackno));
-	for (uint8_t sectno = 0; sectno < sectors; ++sectno)
-	{
-	    if (!rdmap[trackno-1][sectno])
-	    {
-		hasfreeblocks = 1;
-		goto checkzerofree;
-	    }
-	}
-    }
-
-checkzerofree:
-    if (hasfreeblocks)
-    {
-	int zerofree = 1;
-	for (uint8_t trackno = 1; trackno < 36; ++trackno)
-	{
-	    if (bam[4*trackno])
-	    {
-		zerofree = 0;
-		break;
-	    }
-	}
-
-	if (D64_type(d64) == D64_STANDARD)
-	{
-	    if (zerofree) probeopts.flags |= CFF_ZEROFREE;
-	}
-	else if (zerofree)
-	{
-	    if (probeopts.flags & CFF_PROLOGICDOSBAM)
-	    {
-		for (uint8_t trackno = 36; trackno < 41; ++trackno)
-		{
-		    if (bam[4*trackno])
-		    {
-			zerofree = 0;
-			break;
-		    }
-		}
-		if (zerofree) probeopts.flags |= CFF_ZEROFREE;
-	    }
-	    else
-	    {
-		int havedolphin = 0;
-		int havespeed = 0;
-		if (!memcmp(rdmap+35, bamprobedolphin,
-			sizeof bamprobedolphin))
-		{
-		    havedolphin = 1;
-		    for (uint8_t trackno = 36; trackno < 41; ++trackno)
-		    {
-			if (bam[4*trackno + 0x1c])
-			{
-			    zerofree = 0;
-			    break;
-			}
-		    }
-		}
-		if (!memcmp(rdmap+35, bamprobespeed,
-			    sizeof bamprobespeed))
-		{
-		    havespeed = 1;
-		    for (uint8_t trackno = 36; trackno < 41; ++trackno)
-		    {
-			if (bam[4*trackno + 0x30])
-			{
-			    zerofree = 0;
-			    break;
-			}
-		    }
-		}
-		if (zerofree)
-		{
-		    probeopts.flags |= CFF_ZEROFREE;
-		    if (havedolphin) probeopts.flags |= CFF_DOLPHINDOSBAM;
-		    if (havespeed) probeopts.flags |= CFF_SPEEDDOSBAM;
-		}
-	    }
-	}
-    }
+    probeFinish(&probeopts, d64, rdmap, bamprobedolphin, bamprobespeed);
 
 done:
     memcpy(options, &probeopts, sizeof probeopts);
@@ -5,8 +5,8 @@
 
 typedef struct DirData DirData;
 
-int readCbmdosVfsInternal(CbmdosVfs *vfs, const D64 *d64,
+int readCbmdosVfsInternal(CbmdosVfs *vfs, D64 *d64,
 	const CbmdosFsOptions *options,
-	uint8_t (*bamdata)[21], DirData *dirdata);
+	uint32_t *bamdata, DirData *dirdata);
 
 #endif
@@ -1,20 +1,277 @@
 #include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define D64_X86SIMD
+#include <immintrin.h>
+#endif
 
 #include "util.h"
 #include "log.h"
-#include <1541img/track.h>
-#include <1541img/sector.h>
+#include "track.h"
+#include "sector.h"
+#include "sectorpool.h"
+
+#include "d64.h"
 
-#include <1541img/d64.h>
+/* a buffer holding sector data, shared by all images having at least one
+ * track stored in it. Tracks without a store have their sectors in a
+ * SectorPool. */
+typedef struct D64Store
+{
+    uint8_t *data;
+    size_t size;
+    D64BufferRelease release;
+    unsigned refcount;
+    int writable;
+} D64Store;
 
 struct D64
 {
     D64Type type;
-    Track *track[];
+    int readonly;
+    D64Store *own;
+    D64Store *store[42];
+    Track track[42];
+    Sector sector[];
 };
 
 static const uint8_t tracks[] = {35, 40, 42};
 
+/* index of the first sector of each track in the image, the last entry
+ * is the total number of sectors of a 42 tracks image */
+static const uint16_t trackoffset[] = {
+      0,  21,  42,  63,  84, 105, 126, 147, 168, 189, 210, 231, 252, 273,
+    294, 315, 336, 357, 376, 395, 414, 433, 452, 471, 490, 508, 526, 544,
+    562, 580, 598, 615, 632, 649, 666, 683, 700, 717, 734, 751, 768, 785,
+    802
+};
+
+static void freeData(uint8_t *data, size_t size)
+{
+    (void)size;
+    free(data);
+}
+
+static D64Store *D64Store_create(uint8_t *data, size_t size,
+	D64BufferRelease release, int writable)
+{
+    D64Store *self = xmalloc(sizeof *self);
+    self->data = data;
+    self->size = size;
+    self->release = release;
+    self->refcount = 1;
+    self->writable = writable;
+    return self;
+}
+
+static void D64Store_ref(D64Store *self)
+{
+    ++self->refcount;
+}
+
+static void D64Store_release(D64Store *self)
+{
+    if (--self->refcount) return;
+    if (self->release) self->release(self->data, self->size);
+    free(self);
+}
+
+static D64 *allocImage(D64Type type)
+{
+    uint16_t sectors = trackoffset[tracks[type]];
+    D64 *self = xmalloc(sizeof *self + sectors * sizeof *self->sector);
+    self->type = type;
+    self->readonly = 0;
+    self->own = 0;
+    return self;
+}
+
+/* whether any track other than the one given is stored in store */
+static int storeUsed(const D64 *self, const D64Store *store, uint8_t except)
+{
+    for (uint8_t tracknum = 0; tracknum < tracks[self->type]; ++tracknum)
+    {
+	if (tracknum != except && self->store[tracknum] == store) return 1;
+    }
+    return 0;
+}
+
+static int storeHoldsAll(const D64 *self, const D64Store *store)
+{
+    for (uint8_t tracknum = 0; tracknum < tracks[self->type]; ++tracknum)
+    {
+	if (self->store[tracknum] != store) return 0;
+    }
+    return 1;
+}
+
+/* calls fn once for every distinct store used by the image */
+static void forEachStore(D64 *self, void (*fn)(D64Store *))
+{
+    for (uint8_t tracknum = 0; tracknum < tracks[self->type]; ++tracknum)
+    {
+	D64Store *store = self->store[tracknum];
+	if (!store) continue;
+	uint8_t prev = 0;
+	while (prev < tracknum && self->store[prev] != store) ++prev;
+	if (prev == tracknum) fn(store);
+    }
+}
+
+static void bindStore(D64 *self, D64Store *store)
+{
+    for (uint8_t tracknum = 0; tracknum < tracks[self->type]; ++tracknum)
+    {
+	uint16_t offset = trackoffset[tracknum];
+	self->store[tracknum] = store;
+	Track_init(self->track + tracknum, self, tracknum+1,
+		self->sector + offset, store->data + offset * SECTOR_SIZE);
+	self->track[tracknum].shared = !store->writable;
+    }
+}
+
+/* calls fn for every pooled sector of a track */
+static void forEachPooled(Track *track, void (*fn)(uint8_t *))
+{
+    for (uint8_t sectornum = 0; sectornum < track->sectors; ++sectornum)
+    {
+	fn(track->sector[sectornum].content);
+    }
+}
+
+static void moveTrack(D64 *self, uint8_t tracknum, D64Store *store)
+{
+    Track *track = self->track + tracknum;
+    D64Store *old = self->store[tracknum];
+    uint8_t *content = store->data + trackoffset[tracknum] * SECTOR_SIZE;
+    if (old)
+    {
+	memcpy(content, track->sector->content,
+		track->sectors * SECTOR_SIZE);
+    }
+    else
+    {
+	for (uint8_t sectornum = 0; sectornum < track->sectors; ++sectornum)
+	{
+	    memcpy(content + sectornum * SECTOR_SIZE,
+		    track->sector[sectornum].content, SECTOR_SIZE);
+	}
+	forEachPooled(track, SectorPool_release);
+    }
+    Track_rebind(track, content);
+    self->store[tracknum] = store;
+    if (old && !storeUsed(self, old, tracknum)) D64Store_release(old);
+}
+
+SOLOCAL size_t D64_dataSize(D64Type type)
+{
+    return trackoffset[tracks[type]] * SECTOR_SIZE;
+}
+
+SOLOCAL int D64_typeForSize(D64Type *type, size_t size)
+{
+    switch (size)
+    {
+        case 174848UL:
+        case 175531UL:
+            *type = D64_STANDARD;
+            return 0;
+        case 196608UL:
+        case 197376UL:
+            *type = D64_40TRACK;
+            return 0;
+        case 205312UL:
+        case 206114UL:
+            *type = D64_42TRACK;
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+SOLOCAL D64 *D64_fromData(uint8_t *data, size_t size, int readonly,
+	D64BufferRelease release)
+{
+    D64Type type;
+    if (D64_typeForSize(&type, size) < 0)
+    {
+        logmsg(L_ERROR, "D64: buffer doesn't have the size of a valid D64 "
+		"image.");
+        return 0;
+    }
+    D64 *self = allocImage(type);
+    self->readonly = readonly;
+    D64Store *store = D64Store_create(data, size, release, !readonly);
+    if (!readonly) self->own = store;
+    bindStore(self, store);
+    return self;
+}
+
+SOLOCAL D64 *D64_fromPool(SectorPool *pool, const uint8_t *data,
+	D64Type type)
+{
+    D64 *self = allocImage(type);
+    for (uint8_t tracknum = 0; tracknum < tracks[type]; ++tracknum)
+    {
+	Track *track = self->track + tracknum;
+	uint16_t offset = trackoffset[tracknum];
+	self->store[tracknum] = 0;
+	Track_init(track, self, tracknum+1, self->sector + offset,
+		(uint8_t *)data + offset * SECTOR_SIZE);
+	for (uint8_t sectornum = 0; sectornum < track->sectors; ++sectornum)
+	{
+	    track->sector[sectornum].content = SectorPool_intern(pool,
+		    data + (offset + sectornum) * SECTOR_SIZE);
+	}
+	track->shared = 1;
+    }
+    return self;
+}
+
+SOLOCAL uint8_t *D64_data(D64 *self)
+{
+    if (self->readonly)
+    {
+	logmsg(L_ERROR, "D64_data: image is read-only.");
+	return 0;
+    }
+    D64Store *store = self->own;
+    if (!store || store->refcount > 1 || !storeHoldsAll(self, store))
+    {
+	size_t size = D64_dataSize(self->type);
+	store = D64Store_create(xmalloc(size), size, freeData, 1);
+	for (uint8_t tracknum = 0; tracknum < tracks[self->type]; ++tracknum)
+	{
+	    moveTrack(self, tracknum, store);
+	}
+	self->own = store;
+    }
+    for (uint8_t tracknum = 0; tracknum < tracks[self->type]; ++tracknum)
+    {
+	self->track[tracknum].shared = 0;
+	self->track[tracknum].dirty =
+	    (1U << self->track[tracknum].sectors) - 1;
+    }
+    return store->data;
+}
+
+SOLOCAL void D64_unshareTrack(D64 *self, Track *track)
+{
+    uint8_t tracknum = track - self->track;
+    D64Store *store = self->store[tracknum];
+    if (!store || !store->writable || store->refcount > 1)
+    {
+	if (!self->own || self->own->refcount > 1)
+	{
+	    size_t size = D64_dataSize(self->type);
+	    self->own = D64Store_create(xmalloc(size), size, freeData, 1);
+	}
+	moveTrack(self, tracknum, self->own);
+    }
+    track->shared = 0;
+}
+
 SOEXPORT D64 *D64_create(D64Type type)
 {
     if (type < 0 || type > 2)
@@ -22,15 +279,132 @@ SOEXPORT D64 *D64_create(D64Type type)
         logmsg(L_ERROR, "D64: invalid type argument.");
         return 0;
     }
-    D64 *self = xmalloc(sizeof *self + tracks[type] * sizeof *self->track);
+    D64 *self = allocImage(type);
+    size_t size = D64_dataSize(type);
+    uint8_t *data = xmalloc(size);
+    memset(data, 0, size);
+    self->own = D64Store_create(data, size, freeData, 1);
+    bindStore(self, self->own);
+    return self;
+}
+
+/* clears a track, only marking sectors dirty that weren't empty */
+static void clearTrack(Track *track)
+{
+    static const uint8_t empty[SECTOR_SIZE];
+    for (uint8_t sectornum = 0; sectornum < track->sectors; ++sectornum)
+    {
+	uint8_t *content = track->sector[sectornum].content;
+	if (memcmp(content, empty, SECTOR_SIZE))
+	{
+	    memset(content, 0, SECTOR_SIZE);
+	    track->dirty |= 1U << sectornum;
+	}
+    }
+}
+
+SOLOCAL D64 *D64_reset(D64 *self, D64Type type)
+{
+    if (self->readonly) return 0;
+    D64Store *own = self->own;
+    if (type == self->type && own && own->refcount == 1
+	    && storeHoldsAll(self, own))
+    {
+	for (uint8_t tracknum = 0; tracknum < tracks[type]; ++tracknum)
+	{
+	    clearTrack(self->track + tracknum);
+	}
+	return self;
+    }
+
+    size_t size = D64_dataSize(type);
+    if (own && (own->refcount > 1
+		|| (own->size < size && own->release != freeData)))
+    {
+	own = 0;
+    }
+    if (own) D64Store_ref(own);
+    for (uint8_t tracknum = 0; tracknum < tracks[self->type]; ++tracknum)
+    {
+	if (!self->store[tracknum])
+	{
+	    forEachPooled(self->track + tracknum, SectorPool_release);
+	}
+    }
+    forEachStore(self, D64Store_release);
+    if (own)
+    {
+	if (own->size < size)
+	{
+	    own->data = xrealloc(own->data, size);
+	    own->size = size;
+	}
+    }
+    else
+    {
+	own = D64Store_create(xmalloc(size), size, freeData, 1);
+    }
+    memset(own->data, 0, size);
+
+    if (type != self->type)
+    {
+	self = xrealloc(self, sizeof *self
+		+ trackoffset[tracks[type]] * sizeof *self->sector);
+	self->type = type;
+    }
+    self->own = own;
+    bindStore(self, own);
     for (uint8_t tracknum = 0; tracknum < tracks[type]; ++tracknum)
     {
-	self->track[tracknum] = Track_create(tracknum+1);
+	self->track[tracknum].dirty =
+	    (1U << self->track[tracknum].sectors) - 1;
     }
-    self->type = type;
     return self;
 }
 
+SOEXPORT D64 *D64_fromBuffer(const uint8_t *buffer, size_t size,
+	D64BufferMode mode)
+{
+    D64 *self = D64_fromData((uint8_t *)buffer, size, 1, 0);
+    if (self && mode == D64_BM_COPYONWRITE) self->readonly = 0;
+    return self;
+}
+
+SOEXPORT D64 *D64_snapshot(D64 *self)
+{
+    D64 *snapshot = allocImage(self->type);
+    snapshot->readonly = self->readonly;
+    for (uint8_t tracknum = 0; tracknum < tracks[self->type]; ++tracknum)
+    {
+	Track *track = self->track + tracknum;
+	Track *copy = snapshot->track + tracknum;
+	uint16_t offset = trackoffset[tracknum];
+	snapshot->store[tracknum] = self->store[tracknum];
+	Track_init(copy, snapshot, tracknum+1, snapshot->sector + offset,
+		track->sector->content);
+	copy->dirty = track->dirty;
+	copy->shared = 1;
+	track->shared = 1;
+	if (!snapshot->store[tracknum])
+	{
+	    for (uint8_t sectornum = 0; sectornum < track->sectors;
+		    ++sectornum)
+	    {
+		copy->sector[sectornum].content =
+		    track->sector[sectornum].content;
+	    }
+	    forEachPooled(copy, SectorPool_ref);
+	}
+    }
+    forEachStore(snapshot, D64Store_ref);
+    return snapshot;
+}
+
+SOEXPORT int D64_readOnly(const D64 *self)
+{
+    return self->readonly;
+}
+
 SOEXPORT D64Type D64_type(const D64 *self)
 {
     return self->type;
@@ -41,6 +415,153 @@ SOEXPORT uint8_t D64_tracks(const D64 *self)
     return tracks[D64_type(self)];
 }
 
+SOEXPORT size_t D64_size(const D64 *self)
+{
+    return D64_dataSize(self->type);
+}
+
+SOEXPORT int D64_sectorDirty(
+	const D64 *self, uint8_t tracknum, uint8_t sectornum)
+{
+    const Track *track = D64_rtrack(self, tracknum);
+    if (!track || sectornum >= track->sectors) return 0;
+    return !!(track->dirty & (1U << sectornum));
+}
+
+SOEXPORT unsigned D64_dirtySectors(const D64 *self)
+{
+    unsigned dirty = 0;
+    for (uint8_t tracknum = 0; tracknum < tracks[self->type]; ++tracknum)
+    {
+	for (uint32_t bits = self->track[tracknum].dirty; bits; bits &= bits-1)
+	{
+	    ++dirty;
+	}
+    }
+    return dirty;
+}
+
+SOEXPORT void D64_clearDirty(D64 *self)
+{
+    for (uint8_t tracknum = 0; tracknum < tracks[self->type]; ++tracknum)
+    {
+	self->track[tracknum].dirty = 0;
+    }
+}
+
+/* Comparing sectors is done in blocks of 64 bytes with a single branch per
+ * block, the exact position is only searched in a block that differs. On
+ * x86, the widest SIMD instructions available at runtime are used, other
+ * platforms rely on the (usually vectorized) memcmp() of the C library. */
+#ifdef D64_X86SIMD
+__attribute__((target("avx2")))
+static int blockDiffAvx2(const uint8_t *a, const uint8_t *b)
+{
+    for (int pos = 0; pos < SECTOR_SIZE; pos += 64)
+    {
+	__m256i eq = _mm256_and_si256(
+		_mm256_cmpeq_epi8(
+		    _mm256_loadu_si256((const __m256i *)(a + pos)),
+		    _mm256_loadu_si256((const __m256i *)(b + pos))),
+		_mm256_cmpeq_epi8(
+		    _mm256_loadu_si256((const __m256i *)(a + pos + 32)),
+		    _mm256_loadu_si256((const __m256i *)(b + pos + 32))));
+	if ((uint32_t)_mm256_movemask_epi8(eq) != 0xffffffffU) return pos;
+    }
+    return -1;
+}
+
+__attribute__((target("sse2")))
+static int blockDiffSse2(const uint8_t *a, const uint8_t *b)
+{
+    for (int pos = 0; pos < SECTOR_SIZE; pos += 64)
+    {
+	__m128i eq = _mm_set1_epi8(-1);
+	for (int i = 0; i < 64; i += 16)
+	{
+	    eq = _mm_and_si128(eq, _mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)(a + pos + i)),
+			_mm_loadu_si128((const __m128i *)(b + pos + i))));
+	}
+	if (_mm_movemask_epi8(eq) != 0xffff) return pos;
+    }
+    return -1;
+}
+#endif
+
+static int blockDiffGeneric(const uint8_t *a, const uint8_t *b)
+{
+    for (int pos = 0; pos < SECTOR_SIZE; pos += 64)
+    {
+	if (memcmp(a + pos, b + pos, 64)) return pos;
+    }
+    return -1;
+}
+
+/* the CPU features are checked on every call, __builtin_cpu_supports() only
+ * reads flags initialized at startup, so there's no shared state to race on */
+static int blockDiff(const uint8_t *a, const uint8_t *b)
+{
+#ifdef D64_X86SIMD
+    if (__builtin_cpu_supports("avx2")) return blockDiffAvx2(a, b);
+    if (__builtin_cpu_supports("sse2")) return blockDiffSse2(a, b);
+#endif
+    return blockDiffGeneric(a, b);
+}
+
+/* offset of the first byte differing in two sectors, or -1 if equal */
+static int sectorDiff(const uint8_t *a, const uint8_t *b)
+{
+    if (a == b) return -1;
+    int pos = blockDiff(a, b);
+    if (pos < 0) return -1;
+    while (a[pos] == b[pos]) ++pos;
+    return pos;
+}
+
+SOEXPORT unsigned D64_diff(const D64 *self, const D64 *other,
+	uint32_t changed[42], uint8_t firstdiff[42][21])
+{
+    uint8_t common = tracks[self->type];
+    uint8_t total = tracks[other->type];
+    if (common > total)
+    {
+	total = common;
+	common = tracks[other->type];
+    }
+    if (firstdiff) memset(firstdiff, 0, 42 * sizeof *firstdiff);
+
+    unsigned count = 0;
+    uint8_t tracknum = 0;
+    for (; tracknum < common; ++tracknum)
+    {
+	const Track *a = self->track + tracknum;
+	const Track *b = other->track + tracknum;
+	changed[tracknum] = 0;
+	/* tracks in a store are contiguous, so sharing the first sector
+	 * means sharing the whole track */
+	if (self->store[tracknum] && other->store[tracknum]
+		&& a->sector->content == b->sector->content) continue;
+	for (uint8_t sectornum = 0; sectornum < a->sectors; ++sectornum)
+	{
+	    int pos = sectorDiff(a->sector[sectornum].content,
+		    b->sector[sectornum].content);
+	    if (pos < 0) continue;
+	    changed[tracknum] |= 1U << sectornum;
+	    if (firstdiff) firstdiff[tracknum][sectornum] = pos;
+	    ++count;
+	}
+    }
+    for (; tracknum < total; ++tracknum)
+    {
+	uint8_t sectors = Track_sectorsFor(tracknum+1);
+	changed[tracknum] = (1U << sectors) - 1;
+	count += sectors;
+    }
+    for (; tracknum < 42; ++tracknum) changed[tracknum] = 0;
+    return count;
+}
+
 SOEXPORT const Track *D64_rtrack(const D64 *self, uint8_t tracknum)
 {
     if (!tracknum || tracknum > tracks[D64_type(self)])
@@ -49,7 +570,7 @@ SOEXPORT const Track *D64_rtrack(const D64 *self, uint8_t tracknum)
                 tracknum);
         return 0;
     }
-    return self->track[tracknum-1];
+    return self->track + tracknum - 1;
 }
 
 SOEXPORT Track *D64_track(D64 *self, uint8_t tracknum)
@@ -60,7 +581,12 @@ SOEXPORT Track *D64_track(D64 *self, uint8_t tracknum)
                 tracknum);
         return 0;
     }
-    return self->track[tracknum-1];
+    if (self->readonly)
+    {
+	logmsg(L_ERROR, "D64_track: image is read-only.");
+	return 0;
+    }
+    return self->track + tracknum - 1;
 }
 
 SOEXPORT const Sector *D64_rsector(
@@ -81,10 +607,13 @@ SOEXPORT Sector *D64_sector(D64 *self, uint8_t tracknum, uint8_t sectornum)
 SOEXPORT void D64_destroy(D64 *self)
 {
     if (!self) return;
-    for (uint8_t tracknum = 0; tracknum < tracks[D64_type(self)]; ++tracknum)
+    for (uint8_t tracknum = 0; tracknum < tracks[self->type]; ++tracknum)
     {
-	Track_destroy(self->track[tracknum]);
+	if (!self->store[tracknum])
+	{
+	    forEachPooled(self->track + tracknum, SectorPool_release);
+	}
     }
+    forEachStore(self, D64Store_release);
     free(self);
 }
-
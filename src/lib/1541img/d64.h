@@ -0,0 +1,25 @@
+#ifndef D64_H
+#define D64_H
+
+#include <stddef.h>
+
+#include <1541img/d64.h>
+
+C_CLASS_DECL(SectorPool);
+
+typedef void (*D64BufferRelease)(uint8_t *data, size_t size);
+
+size_t D64_dataSize(D64Type type);
+int D64_typeForSize(D64Type *type, size_t size);
+D64 *D64_fromData(uint8_t *data, size_t size, int readonly,
+	D64BufferRelease release);
+D64 *D64_fromPool(SectorPool *pool, const uint8_t *data, D64Type type);
+uint8_t *D64_data(D64 *self);
+void D64_unshareTrack(D64 *self, Track *track);
+
+/* clears all sectors and changes the type, reusing the storage where
+ * possible. Returns the image, which may have moved if the type changed,
+ * or NULL if the image is read-only. */
+D64 *D64_reset(D64 *self, D64Type type);
+
+#endif
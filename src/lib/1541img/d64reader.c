@@ -1,65 +1,132 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200112L
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <stdlib.h>
 #include <string.h>
 
+#include "util.h"
 #include "log.h"
+#include "d64.h"
 #include <1541img/filedata.h>
-#include <1541img/hostfilereader.h>
-#include <1541img/d64.h>
-#include <1541img/track.h>
-#include <1541img/sector.h>
 
 #include <1541img/d64reader.h>
 
+/* largest valid .d64 file: 42 tracks with error info */
+#define D64_MAXFILESIZE 206114UL
+
+static void freeData(uint8_t *data, size_t size)
+{
+    (void)size;
+    free(data);
+}
+
 SOEXPORT D64 *readD64FromFileData(const FileData *file)
 {
     size_t size = FileData_size(file);
     D64Type type;
 
-    switch (size)
+    if (D64_typeForSize(&type, size) < 0)
     {
-        case 174848UL:
-        case 175531UL:
-            type = D64_STANDARD;
-            break;
-        case 196608UL:
-        case 197376UL:
-            type = D64_40TRACK;
-            break;
-        case 205312UL:
-        case 206114UL:
-            type = D64_42TRACK;
-            break;
-        default:
-            logmsg(L_WARNING, "readD64FromFileData: not a valid D64 file.");
-            return 0;
+        logmsg(L_WARNING, "readD64FromFileData: not a valid D64 file.");
+        return 0;
     }
 
     D64 *d64 = D64_create(type);
-    const uint8_t *bytes = FileData_rcontent(file);
-    uint8_t tracks = D64_tracks(d64);
-    for (uint8_t trackno = 1; trackno <= tracks; ++trackno)
+    memcpy(D64_data(d64), FileData_rcontent(file), D64_dataSize(type));
+    D64_clearDirty(d64);
+    return d64;
+}
+
+static uint8_t *readRaw(FILE *file, size_t *size, const char *caller)
+{
+    uint8_t *buf = xmalloc(D64_MAXFILESIZE + 1);
+    size_t nread;
+
+    *size = 0;
+    while (*size <= D64_MAXFILESIZE && (nread = fread(buf + *size, 1,
+		    D64_MAXFILESIZE + 1 - *size, file)))
     {
-        Track *track = D64_track(d64, trackno);
-        uint8_t sectors = Track_sectors(track);
-        for (uint8_t sectno = 0; sectno < sectors; ++sectno)
-        {
-            uint8_t *sectbytes = Sector_content(Track_sector(track, sectno));
-            memcpy(sectbytes, bytes, 256);
-            bytes += 256;
-        }
+        *size += nread;
     }
-    return d64;
+    if (ferror(file))
+    {
+        logfmt(L_WARNING, "%s: error reading file.", caller);
+        free(buf);
+        return 0;
+    }
+    D64Type type;
+    if (D64_typeForSize(&type, *size) < 0)
+    {
+        logfmt(L_WARNING, "%s: not a valid D64 file.", caller);
+        free(buf);
+        return 0;
+    }
+    return xrealloc(buf, *size);
 }
 
 SOEXPORT D64 *readD64(FILE *file)
 {
-    FileData *data = readHostFile(file);
-    if (!data)
+    size_t size;
+    uint8_t *buf = readRaw(file, &size, "readD64");
+    if (!buf) return 0;
+    return D64_fromData(buf, size, 0, freeData);
+}
+
+#ifdef _WIN32
+SOEXPORT D64 *readD64Mapped(const char *filename, D64BufferMode mode)
+{
+    FILE *file = fopen_internal(filename, "rb");
+    if (!file)
     {
-        logmsg(L_WARNING, "readD64: error reading file.");
+        logfmt(L_WARNING, "readD64Mapped: cannot open `%s'.", filename);
         return 0;
     }
+    size_t size;
+    uint8_t *buf = readRaw(file, &size, "readD64Mapped");
+    fclose(file);
+    if (!buf) return 0;
+    return D64_fromData(buf, size, mode == D64_BM_READONLY, freeData);
+}
+#else
+static void unmapData(uint8_t *data, size_t size)
+{
+    munmap(data, size);
+}
 
-    D64 *d64 = readD64FromFileData(data);
-    FileData_destroy(data);
+SOEXPORT D64 *readD64Mapped(const char *filename, D64BufferMode mode)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        logfmt(L_WARNING, "readD64Mapped: cannot open `%s'.", filename);
+        return 0;
+    }
+    struct stat st;
+    D64Type type;
+    if (fstat(fd, &st) < 0 || st.st_size < 0
+            || D64_typeForSize(&type, (size_t)st.st_size) < 0)
+    {
+        logmsg(L_WARNING, "readD64Mapped: not a valid D64 file.");
+        close(fd);
+        return 0;
+    }
+    size_t size = (size_t)st.st_size;
+    /* a private writable mapping lets the kernel copy only the pages that
+     * are actually written to */
+    void *data = mmap(0, size, mode == D64_BM_READONLY ?
+            PROT_READ : PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        logmsg(L_WARNING, "readD64Mapped: cannot map file.");
+        return 0;
+    }
+    D64 *d64 = D64_fromData(data, size, mode == D64_BM_READONLY, unmapData);
+    if (!d64) munmap(data, size);
     return d64;
 }
+#endif
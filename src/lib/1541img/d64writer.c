@@ -1,27 +1,125 @@
-#include <1541img/d64.h>
-#include <1541img/track.h>
-#include <1541img/sector.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "d64.h"
+#include "track.h"
 #include "log.h"
+#include "util.h"
+#include <1541img/filedata.h>
+#include "sector.h"
 
 #include <1541img/d64writer.h>
 
-SOEXPORT int writeD64(FILE *file, const D64 *d64)
+/* The sectors of an image are usually stored in one contiguous buffer, but
+ * tracks of a snapshot may live in different buffers. Images are written as
+ * runs of sectors that are adjacent both in the file and in memory, so an
+ * image in a single buffer is written in one go. */
+typedef int (*RunWriter)(void *ctx, size_t pos, const uint8_t *data,
+	size_t size);
+
+static int writeRuns(const D64 *d64, int dirtyonly, RunWriter writer,
+	void *ctx)
 {
+    const uint8_t *run = 0;
+    size_t runpos = 0;
+    size_t runsize = 0;
+    size_t pos = 0;
     for (uint8_t tracknum = 1; tracknum <= D64_tracks(d64); ++tracknum)
     {
-	const Track *track = D64_rtrack(d64, tracknum);
-	for (uint8_t sectnum = 0; sectnum < Track_sectors(track); ++sectnum)
-	{
-	    const Sector *sector = Track_rsector(track, sectnum);
-	    const uint8_t *content = Sector_rcontent(sector);
-	    if (!fwrite(content, SECTOR_SIZE, 1, file))
+        const Track *track = D64_rtrack(d64, tracknum);
+        for (uint8_t sectnum = 0; sectnum < track->sectors;
+                ++sectnum, pos += SECTOR_SIZE)
+        {
+            const uint8_t *content = track->sector[sectnum].content;
+            int take = !dirtyonly || (track->dirty & (1U << sectnum));
+            if (take && run && content == run + runsize)
             {
-                logmsg(L_ERROR, "writeD64: unknown write error.");
-                return -1;
+                runsize += SECTOR_SIZE;
+                continue;
             }
-	}
+            if (run && writer(ctx, runpos, run, runsize) < 0) return -1;
+            run = take ? content : 0;
+            runpos = pos;
+            runsize = take ? SECTOR_SIZE : 0;
+        }
+    }
+    if (run && writer(ctx, runpos, run, runsize) < 0) return -1;
+    return 0;
+}
+
+static int writeToFile(void *ctx, size_t pos, const uint8_t *data,
+	size_t size)
+{
+    (void)pos;
+    return fwrite(data, size, 1, ctx) ? 0 : -1;
+}
+
+static int writeToFileAt(void *ctx, size_t pos, const uint8_t *data,
+	size_t size)
+{
+    if (fseek(ctx, (long)pos, SEEK_SET) < 0) return -1;
+    return writeToFile(ctx, pos, data, size);
+}
+
+static int writeToBuffer(void *ctx, size_t pos, const uint8_t *data,
+	size_t size)
+{
+    memcpy((uint8_t *)ctx + pos, data, size);
+    return 0;
+}
+
+SOEXPORT int writeD64(FILE *file, const D64 *d64)
+{
+    if (writeRuns(d64, 0, writeToFile, file) < 0)
+    {
+        logmsg(L_ERROR, "writeD64: unknown write error.");
+        return -1;
     }
     logmsg(L_DEBUG, "writeD64: success.");
     return 0;
 }
 
+SOEXPORT size_t writeD64ToBuffer(uint8_t *buffer, size_t size, const D64 *d64)
+{
+    size_t d64size = D64_size(d64);
+    if (size < d64size)
+    {
+        logmsg(L_ERROR, "writeD64ToBuffer: buffer too small.");
+        return 0;
+    }
+    writeRuns(d64, 0, writeToBuffer, buffer);
+    return d64size;
+}
+
+SOEXPORT FileData *writeD64ToFileData(const D64 *d64)
+{
+    size_t d64size = D64_size(d64);
+    uint8_t *buffer = xmalloc(d64size);
+    writeRuns(d64, 0, writeToBuffer, buffer);
+    FileData *data = FileData_adopt(buffer, d64size, free);
+    if (!data)
+    {
+        logmsg(L_ERROR, "writeD64ToFileData: error creating file content.");
+        free(buffer);
+    }
+    return data;
+}
+
+SOEXPORT int writeD64Incremental(FILE *file, D64 *d64)
+{
+    if (fseek(file, 0, SEEK_END) < 0 || ftell(file) < (long)D64_size(d64))
+    {
+        logmsg(L_ERROR, "writeD64Incremental: file doesn't contain a "
+                "complete image.");
+        return -1;
+    }
+
+    if (writeRuns(d64, 1, writeToFileAt, file) < 0 || fflush(file) != 0)
+    {
+        logmsg(L_ERROR, "writeD64Incremental: unknown write error.");
+        return -1;
+    }
+    D64_clearDirty(d64);
+    logmsg(L_DEBUG, "writeD64Incremental: success.");
+    return 0;
+}
@@ -4,6 +4,7 @@
 #include <stdint.h>
 
 #define DIRCHUNK 144
+#define DIRSECTCHUNK 18
 
 typedef struct DirEntry
 {
@@ -12,13 +13,24 @@ typedef struct DirEntry
     uint8_t startsector;
     uint8_t sidetrack;
     uint8_t sidesector;
+    uint8_t unplaced;
+    uint16_t realblocks;
 } DirEntry;
 
+typedef struct DirSector
+{
+    uint8_t track;
+    uint8_t sector;
+} DirSector;
+
 typedef struct DirData
 {
     DirEntry *entries;
     unsigned size;
     unsigned capa;
+    DirSector *chain;
+    unsigned chainsize;
+    unsigned chaincapa;
 } DirData;
 
 #endif
@@ -15,8 +15,46 @@ struct FileData
     size_t capacity;
     Event *changedEvent;
     uint8_t *content;
+    FileDataBufferFree bufferFree;
+    unsigned updating;
+    int pending;
 };
 
+static void changed(FileData *self)
+{
+    if (self->updating) self->pending = 1;
+    else Event_raise(self->changedEvent, 0);
+}
+
+/* sets the capacity, moving adopted content to memory owned by FileData */
+static void setCapacity(FileData *self, size_t capacity)
+{
+    if (self->bufferFree)
+    {
+	uint8_t *content = xmalloc(capacity);
+	if (self->size) memcpy(content, self->content, self->size);
+	self->bufferFree(self->content);
+	self->bufferFree = 0;
+	self->content = content;
+    }
+    else
+    {
+	self->content = xrealloc(self->content, capacity);
+    }
+    self->capacity = capacity;
+}
+
+/* grows the capacity geometrically, so appending is amortized O(1) */
+static void ensureCapacity(FileData *self, size_t size)
+{
+    if (size <= self->capacity) return;
+    size_t capacity = self->capacity < FD_CHUNKSIZE ?
+	FD_CHUNKSIZE : self->capacity;
+    while (capacity < size) capacity *= 2;
+    if (capacity > FILEDATA_MAXSIZE) capacity = FILEDATA_MAXSIZE;
+    setCapacity(self, capacity);
+}
+
 SOEXPORT FileData *FileData_create(void)
 {
     FileData *self = xmalloc(sizeof *self);
@@ -24,6 +62,28 @@ SOEXPORT FileData *FileData_create(void)
     self->size = 0;
     self->capacity = FD_CHUNKSIZE;
     self->changedEvent = Event_create(0, self);
+    self->bufferFree = 0;
+    self->updating = 0;
+    self->pending = 0;
+    return self;
+}
+
+SOEXPORT FileData *FileData_adopt(uint8_t *buffer, size_t size,
+	FileDataBufferFree bufferFree)
+{
+    if (size > FILEDATA_MAXSIZE)
+    {
+	logmsg(L_ERROR, "FileData_adopt: maximum size exceeded.");
+	return 0;
+    }
+    FileData *self = xmalloc(sizeof *self);
+    self->content = buffer;
+    self->size = size;
+    self->capacity = size;
+    self->changedEvent = Event_create(0, self);
+    self->bufferFree = bufferFree;
+    self->updating = 0;
+    self->pending = 0;
     return self;
 }
 
@@ -31,9 +91,12 @@ SOEXPORT FileData *FileData_clone(const FileData *self)
 {
     FileData *cloned = xmalloc(sizeof *cloned);
     cloned->size = self->size;
-    cloned->capacity = self->capacity;
-    cloned->content = xmalloc(self->capacity);
+    cloned->capacity = self->size < FD_CHUNKSIZE ? FD_CHUNKSIZE : self->size;
+    cloned->content = xmalloc(cloned->capacity);
     cloned->changedEvent = Event_create(0, cloned);
+    cloned->bufferFree = 0;
+    cloned->updating = 0;
+    cloned->pending = 0;
     memcpy(cloned->content, self->content, self->size);
     return cloned;
 }
@@ -48,6 +111,17 @@ SOEXPORT const uint8_t *FileData_rcontent(const FileData *self)
     return self->content;
 }
 
+SOEXPORT int FileData_reserve(FileData *self, size_t size)
+{
+    if (size > FILEDATA_MAXSIZE)
+    {
+	logmsg(L_ERROR, "FileData_reserve: maximum size exceeded.");
+	return -1;
+    }
+    if (size > self->capacity) setCapacity(self, size);
+    return 0;
+}
+
 SOEXPORT int FileData_append(FileData *self, const uint8_t *data, size_t size)
 {
     if (self->size + size < size || self->size + size > FILEDATA_MAXSIZE)
@@ -55,14 +129,10 @@ SOEXPORT int FileData_append(FileData *self, const uint8_t *data, size_t size)
         logmsg(L_ERROR, "FileData_append: maximum size exceeded.");
         return -1;
     }
-    while (self->size + size > self->capacity)
-    {
-        self->capacity += FD_CHUNKSIZE;
-        self->content = xrealloc(self->content, self->capacity);
-    }
+    ensureCapacity(self, self->size + size);
     memcpy(self->content + self->size, data, size);
     self->size += size;
-    Event_raise(self->changedEvent, 0);
+    changed(self);
     return 0;
 }
 
@@ -73,13 +143,9 @@ SOEXPORT int FileData_appendByte(FileData *self, uint8_t byte)
         logmsg(L_ERROR, "FileData_appendByte: maximum size exceeded.");
         return -1;
     }
-    if (self->size == self->capacity)
-    {
-        self->capacity += FD_CHUNKSIZE;
-        self->content = xrealloc(self->content, self->capacity);
-    }
+    ensureCapacity(self, self->size + 1);
     self->content[self->size++] = byte;
-    Event_raise(self->changedEvent, 0);
+    changed(self);
     return 0;
 }
 
@@ -90,17 +156,30 @@ SOEXPORT int FileData_appendBytes(FileData *self, uint8_t byte, size_t count)
         logmsg(L_ERROR, "FileData_appendBytes: maximum size exceeded.");
         return -1;
     }
-    while (self->size + count > self->capacity)
-    {
-        self->capacity += FD_CHUNKSIZE;
-        self->content = xrealloc(self->content, self->capacity);
-    }
+    ensureCapacity(self, self->size + count);
     memset(self->content + self->size, byte, count);
     self->size += count;
-    Event_raise(self->changedEvent, 0);
+    changed(self);
     return 0;
 }
 
+SOEXPORT void FileData_beginUpdate(FileData *self)
+{
+    ++self->updating;
+}
+
+SOEXPORT void FileData_endUpdate(FileData *self)
+{
+    if (!self->updating)
+    {
+	logmsg(L_WARNING, "FileData_endUpdate: no update in progress.");
+	return;
+    }
+    if (--self->updating || !self->pending) return;
+    self->pending = 0;
+    Event_raise(self->changedEvent, 0);
+}
+
 SOEXPORT int FileData_setByte(FileData *self, uint8_t byte, size_t pos)
 {
     if (pos >= self->size)
@@ -117,10 +196,26 @@ SOEXPORT Event *FileData_changedEvent(FileData *self)
     return self->changedEvent;
 }
 
+SOEXPORT uint8_t *FileData_release(FileData *self, size_t *size)
+{
+    uint8_t *content = self->content;
+    if (self->bufferFree && self->bufferFree != free)
+    {
+	content = xmalloc(self->size ? self->size : 1);
+	if (self->size) memcpy(content, self->content, self->size);
+	self->bufferFree(self->content);
+    }
+    if (size) *size = self->size;
+    Event_destroy(self->changedEvent);
+    free(self);
+    return content;
+}
+
 SOEXPORT void FileData_destroy(FileData *self)
 {
     if (!self) return;
     Event_destroy(self->changedEvent);
-    free(self->content);
+    if (self->bufferFree) self->bufferFree(self->content);
+    else free(self->content);
     free(self);
 }
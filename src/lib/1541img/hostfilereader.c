@@ -12,6 +12,17 @@ SOEXPORT FileData *readHostFile(FILE *file)
 
     FileData *filedata = FileData_create();
 
+    long start = ftell(file);
+    if (start >= 0 && fseek(file, 0, SEEK_END) == 0)
+    {
+	long end = ftell(file);
+	if (end > start && (unsigned long)(end - start) <= FILEDATA_MAXSIZE)
+	{
+	    FileData_reserve(filedata, end - start);
+	}
+	fseek(file, start, SEEK_SET);
+    }
+
     while ((nread = fread(buf, 1, RBUFSIZE, file)))
     {
 	if (FileData_append(filedata, buf, nread) < 0)
@@ -2,19 +2,25 @@
 #include <string.h>
 
 #include "util.h"
-#include <1541img/sector.h>
+#include "track.h"
+#include "d64.h"
 
-struct Sector
+#include "sector.h"
+
+SOLOCAL void Sector_init(Sector *self, Track *track, uint8_t tracknum,
+	uint8_t sectornum, uint8_t *content)
 {
-    uint8_t tracknum;
-    uint8_t sectornum;
-    uint8_t content[SECTOR_SIZE];
-};
+    self->content = content;
+    self->track = track;
+    self->tracknum = tracknum;
+    self->sectornum = sectornum;
+}
 
 SOEXPORT Sector *Sector_create(void)
 {
-    Sector *self = xmalloc(sizeof *self);
-    memset(self, 0, sizeof *self);
+    Sector *self = xmalloc(sizeof *self + SECTOR_SIZE);
+    Sector_init(self, 0, 0, 0, (uint8_t *)(self + 1));
+    memset(self->content, 0, SECTOR_SIZE);
     return self;
 }
 
@@ -33,6 +39,14 @@ SOEXPORT const uint8_t *Sector_rcontent(const Sector *self)
 
 SOEXPORT uint8_t *Sector_content(Sector *self)
 {
+    if (self->track)
+    {
+	if (self->track->shared)
+	{
+	    D64_unshareTrack(self->track->d64, self->track);
+	}
+	self->track->dirty |= 1U << (self - self->track->sector);
+    }
     return self->content;
 }
 
@@ -60,4 +74,3 @@ SOEXPORT void Sector_destroy(Sector *self)
 {
     free(self);
 }
-
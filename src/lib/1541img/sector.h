@@ -0,0 +1,19 @@
+#ifndef SECTOR_H
+#define SECTOR_H
+
+#include <1541img/sector.h>
+
+C_CLASS_DECL(Track);
+
+struct Sector
+{
+    uint8_t *content;
+    Track *track;
+    uint8_t tracknum;
+    uint8_t sectornum;
+};
+
+void Sector_init(Sector *self, Track *track, uint8_t tracknum,
+	uint8_t sectornum, uint8_t *content);
+
+#endif
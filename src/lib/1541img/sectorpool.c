@@ -0,0 +1,160 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "log.h"
+#include "d64.h"
+#include <1541img/filedata.h>
+#include <1541img/sector.h>
+
+#include "sectorpool.h"
+
+#define SP_MINBUCKETS 1024
+
+typedef struct PooledSector PooledSector;
+
+struct PooledSector
+{
+    PooledSector *next;
+    SectorPool *pool;
+    uint64_t hash;
+    unsigned refcount;
+    uint8_t content[SECTOR_SIZE];
+};
+
+struct SectorPool
+{
+    PooledSector **bucket;
+    size_t buckets;
+    size_t sectors;
+    int destroyed;
+};
+
+static uint64_t hashSector(const uint8_t *content)
+{
+    uint64_t hash = 0x9e3779b97f4a7c15ULL;
+    for (size_t pos = 0; pos < SECTOR_SIZE; pos += sizeof hash)
+    {
+	uint64_t word;
+	memcpy(&word, content + pos, sizeof word);
+	hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+static PooledSector *entry(uint8_t *content)
+{
+    return (PooledSector *)(content - offsetof(PooledSector, content));
+}
+
+static void grow(SectorPool *self)
+{
+    size_t buckets = self->buckets << 1;
+    PooledSector **bucket = xmalloc(buckets * sizeof *bucket);
+    memset(bucket, 0, buckets * sizeof *bucket);
+    for (size_t i = 0; i < self->buckets; ++i)
+    {
+	PooledSector *next;
+	for (PooledSector *sector = self->bucket[i]; sector; sector = next)
+	{
+	    next = sector->next;
+	    PooledSector **slot = bucket + (sector->hash & (buckets - 1));
+	    sector->next = *slot;
+	    *slot = sector;
+	}
+    }
+    free(self->bucket);
+    self->bucket = bucket;
+    self->buckets = buckets;
+}
+
+SOEXPORT SectorPool *SectorPool_create(void)
+{
+    SectorPool *self = xmalloc(sizeof *self);
+    self->bucket = xmalloc(SP_MINBUCKETS * sizeof *self->bucket);
+    memset(self->bucket, 0, SP_MINBUCKETS * sizeof *self->bucket);
+    self->buckets = SP_MINBUCKETS;
+    self->sectors = 0;
+    self->destroyed = 0;
+    return self;
+}
+
+SOLOCAL uint8_t *SectorPool_intern(SectorPool *self, const uint8_t *content)
+{
+    uint64_t hash = hashSector(content);
+    PooledSector **slot = self->bucket + (hash & (self->buckets - 1));
+    for (PooledSector *sector = *slot; sector; sector = sector->next)
+    {
+	if (sector->hash == hash
+		&& !memcmp(sector->content, content, SECTOR_SIZE))
+	{
+	    ++sector->refcount;
+	    return sector->content;
+	}
+    }
+    if (self->sectors >= self->buckets)
+    {
+	grow(self);
+	slot = self->bucket + (hash & (self->buckets - 1));
+    }
+    PooledSector *sector = xmalloc(sizeof *sector);
+    sector->next = *slot;
+    sector->pool = self;
+    sector->hash = hash;
+    sector->refcount = 1;
+    memcpy(sector->content, content, SECTOR_SIZE);
+    *slot = sector;
+    ++self->sectors;
+    return sector->content;
+}
+
+SOLOCAL void SectorPool_ref(uint8_t *content)
+{
+    ++entry(content)->refcount;
+}
+
+SOLOCAL void SectorPool_release(uint8_t *content)
+{
+    PooledSector *sector = entry(content);
+    if (--sector->refcount) return;
+    SectorPool *self = sector->pool;
+    PooledSector **slot = self->bucket + (sector->hash & (self->buckets - 1));
+    while (*slot != sector) slot = &(*slot)->next;
+    *slot = sector->next;
+    free(sector);
+    if (!--self->sectors && self->destroyed)
+    {
+	free(self->bucket);
+	free(self);
+    }
+}
+
+SOEXPORT D64 *SectorPool_readD64(SectorPool *self, const FileData *file)
+{
+    D64Type type;
+    if (D64_typeForSize(&type, FileData_size(file)) < 0)
+    {
+        logmsg(L_WARNING, "SectorPool_readD64: not a valid D64 file.");
+        return 0;
+    }
+    return D64_fromPool(self, FileData_rcontent(file), type);
+}
+
+SOEXPORT size_t SectorPool_sectors(const SectorPool *self)
+{
+    return self->sectors;
+}
+
+SOEXPORT void SectorPool_destroy(SectorPool *self)
+{
+    if (!self) return;
+    if (self->sectors)
+    {
+	self->destroyed = 1;
+	return;
+    }
+    free(self->bucket);
+    free(self);
+}
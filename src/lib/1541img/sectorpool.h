@@ -0,0 +1,12 @@
+#ifndef SECTORPOOL_H
+#define SECTORPOOL_H
+
+#include <stdint.h>
+
+#include <1541img/sectorpool.h>
+
+uint8_t *SectorPool_intern(SectorPool *self, const uint8_t *content);
+void SectorPool_ref(uint8_t *content);
+void SectorPool_release(uint8_t *content);
+
+#endif
@@ -1,19 +1,13 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "util.h"
 #include "log.h"
+#include "sector.h"
 
-#include <1541img/track.h>
-#include <1541img/sector.h>
+#include "track.h"
 
-struct Track
-{
-    uint8_t tracknum;
-    uint8_t sectors;
-    Sector *sector[];
-};
-
-static uint8_t getsectors(uint8_t tracknum)
+SOLOCAL uint8_t Track_sectorsFor(uint8_t tracknum)
 {
     if (!tracknum || tracknum > 42) return 0;
     if (tracknum < 18) return 21;
@@ -22,21 +16,44 @@ static uint8_t getsectors(uint8_t tracknum)
     return 17;
 }
 
+SOLOCAL void Track_init(Track *self, D64 *d64, uint8_t tracknum,
+	Sector *sectors, uint8_t *content)
+{
+    self->sector = sectors;
+    self->d64 = d64;
+    self->dirty = 0;
+    self->tracknum = tracknum;
+    self->sectors = Track_sectorsFor(tracknum);
+    self->shared = 0;
+    for (uint8_t sectornum = 0; sectornum < self->sectors; ++sectornum)
+    {
+	Sector_init(self->sector + sectornum, self, tracknum, sectornum,
+		content + sectornum * SECTOR_SIZE);
+    }
+}
+
+SOLOCAL void Track_rebind(Track *self, uint8_t *content)
+{
+    for (uint8_t sectornum = 0; sectornum < self->sectors; ++sectornum)
+    {
+	self->sector[sectornum].content = content + sectornum * SECTOR_SIZE;
+    }
+}
+
 SOEXPORT Track *Track_create(uint8_t tracknum)
 {
-    uint8_t sectors = getsectors(tracknum);
+    uint8_t sectors = Track_sectorsFor(tracknum);
     if (!sectors)
     {
         logfmt(L_ERROR, "Track: invalid track number %hhu.", tracknum);
         return 0;
     }
-    Track *self = xmalloc(sizeof *self + sectors * sizeof *self->sector);
-    for (uint8_t sectornum = 0; sectornum < sectors; ++sectornum)
-    {
-	self->sector[sectornum] = Sector_createAt(tracknum, sectornum);
-    }
-    self->tracknum = tracknum;
-    self->sectors = sectors;
+    Track *self = xmalloc(sizeof *self
+	    + sectors * (sizeof *self->sector + SECTOR_SIZE));
+    Sector *sectorviews = (Sector *)(self + 1);
+    uint8_t *content = (uint8_t *)(sectorviews + sectors);
+    memset(content, 0, sectors * SECTOR_SIZE);
+    Track_init(self, 0, tracknum, sectorviews, content);
     return self;
 }
 
@@ -48,7 +65,7 @@ SOEXPORT const Sector *Track_rsector(const Track *self, uint8_t sectornum)
 		"requested.", sectornum);
         return 0;
     }
-    return self->sector[sectornum];
+    return self->sector + sectornum;
 }
 
 SOEXPORT Sector *Track_sector(Track *self, uint8_t sectornum)
@@ -59,7 +76,7 @@ SOEXPORT Sector *Track_sector(Track *self, uint8_t sectornum)
                 sectornum);
         return 0;
     }
-    return self->sector[sectornum];
+    return self->sector + sectornum;
 }
 
 SOEXPORT uint8_t Track_trackNum(const Track *self)
@@ -74,11 +91,5 @@ SOEXPORT uint8_t Track_sectors(const Track *self)
 
 SOEXPORT void Track_destroy(Track *self)
 {
-    if (!self) return;
-    for (uint8_t sectornum = 0; sectornum < self->sectors; ++sectornum)
-    {
-	Sector_destroy(self->sector[sectornum]);
-    }
     free(self);
 }
-
@@ -0,0 +1,23 @@
+#ifndef TRACK_H
+#define TRACK_H
+
+#include <1541img/track.h>
+
+C_CLASS_DECL(D64);
+
+struct Track
+{
+    Sector *sector;
+    D64 *d64;
+    uint32_t dirty;
+    uint8_t tracknum;
+    uint8_t sectors;
+    uint8_t shared;
+};
+
+uint8_t Track_sectorsFor(uint8_t tracknum);
+void Track_init(Track *self, D64 *d64, uint8_t tracknum, Sector *sectors,
+	uint8_t *content);
+void Track_rebind(Track *self, uint8_t *content);
+
+#endif
@@ -164,7 +164,7 @@ static ZcFileSet *fromFileDataInternal(const FileData *file, int logerrors)
     D64 *d64 = readD64FromFileData(file);
     if (!d64) return 0;
     CbmdosVfs *vfs = CbmdosVfs_create();
-    int rc = readCbmdosVfs(vfs, d64, 0);
+    int rc = readCbmdosVfsLazy(vfs, d64, 0);
     D64_destroy(d64);
     if (rc < 0)
     {